@@ -0,0 +1,83 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _PLUTONRIVER_ANIMATION_ENCODER_HPP_
+#define _PLUTONRIVER_ANIMATION_ENCODER_HPP_
+
+#include <plutonriver/renderer.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace rive
+{
+  enum class PlutoVG_AnimationFormat
+  {
+    apng,
+    gif,
+  };
+
+  // Encodes frames rendered by PlutoVG_Renderer into an animated PNG or GIF.
+  // Each frame only stores the sub-rectangle that changed since the previous
+  // one, and frames identical to the previous one extend its display time.
+  class PlutoVG_AnimationEncoder
+  {
+  public:
+    // A `loopCount` of 0 loops forever.
+    PlutoVG_AnimationEncoder(PlutoVG_AnimationFormat format, float fps, int loopCount = 0);
+
+    // `damage`, when known, bounds the pixels that may differ from the
+    // previous frame: only that area is compared against it. Every frame must
+    // have the size of the first one.
+    bool addFrame(const uint8_t* data, int width, int height, int stride, const PlutoVG_IRect* damage = nullptr);
+    bool addFrame(PlutoVG_Renderer& renderer, const PlutoVG_IRect* damage = nullptr);
+
+    // Shows the previous frame for one more frame.
+    void repeatFrame();
+
+    // Returns the encoded file, or an empty vector if no frame was added.
+    std::vector<uint8_t> finish();
+
+  private:
+    void writePending();
+    void writePNGFrame();
+    void writeGIFFrame();
+
+    PlutoVG_AnimationFormat m_format;
+    float m_fps;
+    int m_loopCount;
+    int m_width{0};
+    int m_height{0};
+
+    // Full copies of the pending frame (not written until its duration is
+    // known) and of the frame before it.
+    std::vector<uint32_t> m_pending;
+    std::vector<uint32_t> m_beforePending;
+    PlutoVG_IRect m_pendingRect;
+    // GIF only: area of the pending frame cleared by the disposal of the frame
+    // before it, and whether the pending frame clears its own area.
+    PlutoVG_IRect m_pendingCleared;
+    bool m_pendingDisposes{false};
+    int m_pendingStart{0};
+    int m_frameTicks{0};
+
+    int m_writtenFrames{0};
+    uint32_t m_sequence{0};
+    std::vector<uint8_t> m_body;
+  };
+} // namespace rive
+
+#endif
@@ -22,9 +22,14 @@
 
 namespace rive
 {
+  class PlutoVG_PathPool;
+
   class PlutonRiver_Factory : public Factory
   {
   public:
+    PlutonRiver_Factory();
+    ~PlutonRiver_Factory() override;
+
     rcp<RenderBuffer> makeBufferU16(Span<const uint16_t>) override;
     rcp<RenderBuffer> makeBufferU32(Span<const uint32_t>) override;
     rcp<RenderBuffer> makeBufferF32(Span<const float>) override;
@@ -52,6 +57,11 @@ namespace rive
     std::unique_ptr<RenderPaint> makeRenderPaint() override;
 
     std::unique_ptr<RenderImage> decodeImage(Span<const uint8_t>) override;
+
+  private:
+    // Storage of destroyed paths, reused by the paths made next. Paths hold a
+    // reference, so they may outlive the factory.
+    rcp<PlutoVG_PathPool> m_pathPool;
   };
 } // namespace rive
 
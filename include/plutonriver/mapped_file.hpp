@@ -0,0 +1,54 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _PLUTONRIVER_MAPPED_FILE_HPP_
+#define _PLUTONRIVER_MAPPED_FILE_HPP_
+
+#include <rive/span.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace rive
+{
+  // A read-only memory mapping of a file, meant to be handed to File::import
+  // without copying the file into a heap buffer first.
+  class PlutonRiver_MappedFile
+  {
+  public:
+    static std::unique_ptr<PlutonRiver_MappedFile> open(const char* path);
+
+    ~PlutonRiver_MappedFile();
+
+    PlutonRiver_MappedFile(const PlutonRiver_MappedFile&) = delete;
+    PlutonRiver_MappedFile& operator=(const PlutonRiver_MappedFile&) = delete;
+
+    Span<const uint8_t> bytes() const { return Span<const uint8_t>(m_data, m_size); }
+    size_t size() const { return m_size; }
+
+  private:
+    PlutonRiver_MappedFile() = default;
+
+    const uint8_t* m_data{nullptr};
+    size_t m_size{0};
+#ifdef _WIN32
+    void* m_mapping{nullptr};
+#endif
+  };
+} // namespace rive
+
+#endif
@@ -17,17 +17,231 @@
 #ifndef _PLUTONRIVER_RENDERER_HPP_
 #define _PLUTONRIVER_RENDERER_HPP_
 
+#include <rive/refcnt.hpp>
 #include <rive/renderer.hpp>
 
 #include <plutovg.h>
 
+#include <vector>
+
 namespace rive
 {
+  class CoverageRasterizer;
+
+  // An integer pixel rectangle, [x, x + width) x [y, y + height).
+  struct PlutoVG_IRect
+  {
+    int x{0};
+    int y{0};
+    int width{0};
+    int height{0};
+
+    bool empty() const { return width <= 0 || height <= 0; }
+
+    bool operator==(const PlutoVG_IRect& other) const
+    {
+      return x == other.x && y == other.y && width == other.width && height == other.height;
+    }
+
+    bool contains(const PlutoVG_IRect& other) const
+    {
+      return other.x >= x && other.y >= y && other.x + other.width <= x + width && other.y + other.height <= y + height;
+    }
+
+    PlutoVG_IRect united(const PlutoVG_IRect& other) const
+    {
+      if (empty())
+        return other;
+      if (other.empty())
+        return *this;
+
+      const int left = x < other.x ? x : other.x;
+      const int top = y < other.y ? y : other.y;
+      const int right = x + width > other.x + other.width ? x + width : other.x + other.width;
+      const int bottom = y + height > other.y + other.height ? y + height : other.y + other.height;
+      return {left, top, right - left, bottom - top};
+    }
+
+    PlutoVG_IRect intersected(const PlutoVG_IRect& other) const
+    {
+      const int left = x > other.x ? x : other.x;
+      const int top = y > other.y ? y : other.y;
+      const int right = x + width < other.x + other.width ? x + width : other.x + other.width;
+      const int bottom = y + height < other.y + other.height ? y + height : other.y + other.height;
+      if (right <= left || bottom <= top)
+        return {};
+
+      return {left, top, right - left, bottom - top};
+    }
+  };
+
+  // Memory layouts a renderer can draw into, all of them premultiplied.
+  enum class PlutoVG_PixelFormat
+  {
+    // plutovg's native 32-bit words.
+    argb32Premultiplied,
+    // B, G, R, A bytes: the native words of a little-endian host.
+    bgra8888,
+    // R, G, B, A bytes, composited natively by swapping red and blue in every
+    // color, gradient and image drawn.
+    rgba8888,
+    // Opaque 5:6:5 words. plutovg has no 16-bit compositor: frames are drawn
+    // into an ARGB32 working surface and packed into the buffer by flush().
+    rgb565,
+    // Coverage only, 8 bits per pixel: paths are drawn opaque whatever their
+    // paint, and images cover their whole rectangle, so the buffer holds the
+    // union of everything drawn, as masks and hit maps need. Shapes are
+    // rasterized straight into the buffer, without plutovg.
+    a8,
+  };
+
+  // Classes of transforms, each one containing the previous ones, so that
+  // transforms known to be simpler take cheaper paths.
+  enum class PlutoVG_MatrixType
+  {
+    identity,
+    translate,
+    scaleTranslate,
+    affine,
+  };
+
   class PlutoVG_Renderer : public Renderer
   {
   protected:
     plutovg_t* m_context;
     plutovg_surface_t* m_surface;
+    PlutoVG_PixelFormat m_format{PlutoVG_PixelFormat::argb32Premultiplied};
+    // The caller's buffer when it is not m_surface's own data.
+    uint8_t* m_target{nullptr};
+    int m_targetStride{0};
+    int m_targetWidth{0};
+    int m_targetHeight{0};
+    // Draws into a8 buffers, which have no surface or context.
+    CoverageRasterizer* m_coverage{nullptr};
+
+    // Shadow of the state of a plutovg context, so that draws only issue the
+    // calls that change something. Contexts are never saved or restored.
+    struct ContextState
+    {
+      Mat2D matrix;
+      // Sources are identified by the color set, or by the gradient or texture
+      // object, which the context keeps alive while it is its source.
+      enum class Source
+      {
+        unknown,
+        color,
+        gradient,
+        texture,
+      };
+      Source source{Source::unknown};
+      unsigned int color{0};
+      const void* sourceObject{nullptr};
+      plutovg_fill_rule_t fillRule{plutovg_fill_rule_non_zero};
+      float lineWidth{1.0f};
+      plutovg_line_cap_t lineCap{plutovg_line_cap_butt};
+      plutovg_line_join_t lineJoin{plutovg_line_join_miter};
+      float opacity{1.0f};
+      plutovg_operator_t op{plutovg_operator_src_over};
+    };
+
+    // A clip rasterized once into a context of its own, which draws under it
+    // are made with. Levels are immutable: they are shared by the states saved
+    // under them, clipping again makes a child level, and they are looked up
+    // again by the next frames making the same clips. The context draws into a
+    // view of the pixels within the clip bounds, which bounds what plutovg
+    // rasterizes and keeps for the clip: nested clips get smaller views.
+    struct ClipLevel : public RefCnt<ClipLevel>
+    {
+      ~ClipLevel();
+
+      // What the level was made from: a path of the given generation under a
+      // transform, or a device rectangle, clipped within the parent level.
+      rcp<ClipLevel> parent;
+      uint64_t generation{0};
+      Mat2D matrix;
+      plutovg_fill_rule_t fillRule{plutovg_fill_rule_non_zero};
+      PlutoVG_IRect rect;
+
+      // The clip in device space, replayed into the levels made under it.
+      plutovg_path_t* path{nullptr};
+      // No context is made for an empty view, nothing is drawn under it.
+      PlutoVG_IRect view;
+      plutovg_surface_t* surface{nullptr};
+      plutovg_t* context{nullptr};
+      ContextState state;
+      // a8 renderers have no contexts: their levels keep the coverage of the
+      // clip over the view instead, one byte per pixel, rows view.width apart.
+      std::vector<uint8_t> mask;
+      // The last frame the level was made or looked up in.
+      uint64_t frame{0};
+
+      // Set for levels clipping the context above them in place, between a
+      // plutovg save and restore, rather than owning one: the state of that
+      // context, and the state it had before, restored with it.
+      ContextState* owner{nullptr};
+      ContextState ownerSaved;
+    };
+
+    // Drawing state, saved and restored by save() and restore(). Saves are
+    // only counted until the state is changed, see materializeSave().
+    struct State
+    {
+      // Saves of this state that have no copy on m_stateStack yet.
+      unsigned int deferredSaves{0};
+      Mat2D matrix;
+      // At least as general as the class of `matrix`.
+      PlutoVG_MatrixType matrixType{PlutoVG_MatrixType::identity};
+      // Null without a clip, or when it is only a scissor.
+      rcp<ClipLevel> clip;
+      // Conservative device bounds of the clip, when there is one.
+      bool clipped{false};
+      PlutoVG_IRect clipBounds;
+      // Pixel-aligned rectangle clips made without a clip level are kept as a
+      // scissor, and draws crossing them are drawn through a context over the
+      // rectangle's pixels, see bindContext().
+      bool scissored{false};
+      PlutoVG_IRect scissor;
+    };
+    State m_state;
+    std::vector<State> m_stateStack;
+    // Saves not restored yet, deferred ones included.
+    unsigned int m_saveCount{0};
+
+    // Shadow of m_context, which never has a clip.
+    ContextState m_contextState;
+    // The context the current draw is made with, its shadow, and the device
+    // position of the pixels it draws into.
+    plutovg_t* m_drawContext{nullptr};
+    ContextState* m_drawState{nullptr};
+    int m_drawX{0};
+    int m_drawY{0};
+
+    // Clip levels made or used by the last few frames, see endFrame().
+    std::vector<rcp<ClipLevel>> m_clipLevels;
+    // Counts the frames that made or used clip levels, ended by the outermost
+    // restore(), clear() or reset().
+    uint64_t m_frame{0};
+    bool m_frameUsedClips{false};
+    // Path generations past this one were made after the previous frame.
+    uint64_t m_frameGeneration{0};
+
+    // Consecutive solid fills of one color, merged in device space and drawn
+    // with a single fill, along with the device bounds of each of them.
+    plutovg_path_t* m_batchPath{nullptr};
+    std::vector<PlutoVG_IRect> m_batchBounds;
+    unsigned int m_batchColor{0};
+    plutovg_fill_rule_t m_batchFillRule{plutovg_fill_rule_non_zero};
+    // Device-space bounds of everything drawn since the last clear(), as one
+    // box, see damage().
+    PlutoVG_IRect m_damage;
+    // Scratch path holding the visible part of a path crossing the viewport.
+    plutovg_path_t* m_preClipPath{nullptr};
+    // A view of the pixels of the last scissor drawn through, with the shadow
+    // of its context's state.
+    plutovg_surface_t* m_scissorSurface{nullptr};
+    plutovg_t* m_scissorContext{nullptr};
+    PlutoVG_IRect m_scissorView;
+    ContextState m_scissorState;
 
   public:
     PlutoVG_Renderer(plutovg_surface_t* surface)
@@ -36,8 +250,19 @@ namespace rive
     {
     }
 
+    // Draws into a caller-owned buffer of `format` pixels whose rows are
+    // `stride` bytes apart. The buffer must outlive the renderer.
+    PlutoVG_Renderer(uint8_t* data, int width, int height, int stride, PlutoVG_PixelFormat format);
+
     ~PlutoVG_Renderer() override;
 
+    // Retargets the renderer, which starts over with an identity matrix and no
+    // clip. Targeting the same surface or buffer again (cleared by the caller)
+    // keeps the plutovg contexts and the clips cached in them, and so does a
+    // buffer of the same size for the formats drawn through a working surface.
+    void reset(plutovg_surface_t* surface);
+    void reset(uint8_t* data, int width, int height, int stride, PlutoVG_PixelFormat format);
+
     void save() override;
     void restore() override;
     void transform(const Mat2D& transform) override;
@@ -51,12 +276,106 @@ namespace rive
       BlendMode,
       float opacity) override;
 
+    // Zeroes the pixels drawn since the last clear(). The target is assumed to
+    // be cleared when the renderer is created or reset, so sparse frames on a
+    // large surface only pay for the area they covered.
+    void clear();
+
+    // Device-space bounds of everything drawn since the last clear(), the
+    // only pixels that can differ from the cleared surface. It is a single
+    // bounding box: two small draws in opposite corners damage, and get
+    // cleared, everything between them.
+    const PlutoVG_IRect& damage() const { return m_damage; }
+
+    // Completes pending draws and stores the frame into the caller's buffer.
+    // Only rgb565 buffers need it: every other format is drawn into in
+    // place, and the pending fills of a frame are drawn when its outermost
+    // save is restored, when data() is read, or when the renderer is reset or
+    // destroyed.
+    void flush();
+
+    PlutoVG_PixelFormat format() const { return m_format; }
+
+    // The surface being drawn into: the caller's buffer, or the ARGB32 working
+    // surface of an rgb565 renderer.
     int width() const;
     int height() const;
     int stride() const;
-    uint8_t* data() const;
+    // Reading the pixels draws the pending fills first.
+    uint8_t* data();
+
+    void writePNG(const char* filename);
+    std::vector<uint8_t> encodePNG();
+    std::vector<uint8_t> encodeQOI();
+
+  private:
+    void attach(uint8_t* data, int width, int height, int stride, PlutoVG_PixelFormat format);
+    void detach();
+    bool attached() const { return m_context != nullptr || m_coverage != nullptr; }
+    void loadTarget();
+    void resetState();
+    void materializeSave();
+    float devicePad(float outset) const;
+    PlutoVG_IRect deviceBounds(float minX, float minY, float maxX, float maxY, float outset) const;
+    const plutovg_path_t* preClip(const plutovg_path_t* path, float minX, float minY, float maxX, float maxY, float outset);
+
+    bool crossesScissor(const PlutoVG_IRect& bounds) const;
+    void bindContext(bool scissor);
+    void releaseScissor();
+
+    rcp<ClipLevel> findClipLevel(uint64_t generation, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& rect);
+    rcp<ClipLevel> makeClipLevel(plutovg_path_t* devicePath, uint64_t generation, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& rect, const PlutoVG_IRect& view, bool cached = true);
+    rcp<ClipLevel> clipInPlace(plutovg_path_t* devicePath, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& view);
+    bool clipChanges(uint64_t generation) const;
+    void endFrame();
+    PlutoVG_IRect visibleBounds(const PlutoVG_IRect& bounds) const;
+
+    bool blitImage(plutovg_texture_t* texture, float opacity);
+    void compositeCoverage(plutovg_fill_rule_t fillRule, const PlutoVG_IRect& area);
+
+    bool canBatch(unsigned int color, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& bounds) const;
+    void flushBatch();
+    void discardBatch();
+    void completeDraws();
+
+    void setMatrix(const Mat2D& matrix);
+    void setDeviceMatrix(const Mat2D& matrix);
+    void setColorSource(unsigned int color);
+    void setGradientSource(plutovg_gradient_t* gradient);
+    void setTextureSource(plutovg_texture_t* texture);
+    void setFillRule(plutovg_fill_rule_t fillRule);
+    void setStroke(float width, plutovg_line_cap_t cap, plutovg_line_join_t join);
+    void setComposite(float opacity, plutovg_operator_t op);
+  };
+
+  // Hashes the stream of draw calls (paths, paints, matrices, clips) instead
+  // of rasterizing it. Two frames drawn with the same hash produce the same
+  // pixels, which lets sequence exports skip rasterizing repeated frames.
+  class PlutoVG_HashRenderer : public Renderer
+  {
+  public:
+    void reset() { m_hash = 0xcbf29ce484222325ull; }
+    uint64_t hash() const { return m_hash; }
+
+    void save() override;
+    void restore() override;
+    void transform(const Mat2D& transform) override;
+    void clipPath(RenderPath* path) override;
+    void drawPath(RenderPath* path, RenderPaint* paint) override;
+    void drawImage(const RenderImage*, BlendMode, float opacity) override;
+    void drawImageMesh(const RenderImage*,
+      rcp<RenderBuffer> vertices_f32,
+      rcp<RenderBuffer> uvCoords_f32,
+      rcp<RenderBuffer> indices_u16,
+      BlendMode,
+      float opacity) override;
+
+  private:
+    void mix(uint64_t value);
+    void mix(float value);
+    void mixPath(const RenderPath* path);
 
-    void writePNG(const char* filename) const;
+    uint64_t m_hash{0xcbf29ce484222325ull};
   };
 } // namespace rive
 
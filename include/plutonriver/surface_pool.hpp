@@ -0,0 +1,87 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _PLUTONRIVER_SURFACE_POOL_HPP_
+#define _PLUTONRIVER_SURFACE_POOL_HPP_
+
+#include <plutonriver/renderer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace rive
+{
+  // Recycles pixel buffers keyed by (width, height, format) so that repeated
+  // renders neither allocate nor page-fault their targets. Buffers are handed
+  // out cleared, 64-byte aligned, with rows padded to 16 bytes. Thread-safe.
+  class PlutoVG_SurfacePool
+  {
+  public:
+    // At most `maxIdleBytes` of released buffers are kept, the least recently
+    // released ones are freed first.
+    explicit PlutoVG_SurfacePool(size_t maxIdleBytes = size_t(256) << 20);
+    ~PlutoVG_SurfacePool();
+
+    PlutoVG_SurfacePool(const PlutoVG_SurfacePool&) = delete;
+    PlutoVG_SurfacePool& operator=(const PlutoVG_SurfacePool&) = delete;
+
+    static int bytesPerPixel(PlutoVG_PixelFormat format);
+
+    // Returns nullptr if the allocation fails.
+    uint8_t* acquire(int width, int height, PlutoVG_PixelFormat format, int& stride);
+    // An ARGB32 surface over a pooled buffer, released with releaseSurface().
+    plutovg_surface_t* acquireSurface(int width, int height);
+
+    // Takes back a buffer returned by acquire(). Its content is discarded.
+    // `damage` bounds the pixels written since it was acquired, as a
+    // renderer's damage() does, and is the only area cleared before the
+    // buffer is handed out again: a buffer released after a renderer's
+    // clear() is not cleared again. Without it, the whole buffer is.
+    void release(uint8_t* data, const PlutoVG_IRect* damage = nullptr);
+    void releaseSurface(plutovg_surface_t* surface, const PlutoVG_IRect* damage = nullptr);
+
+    // Frees every idle buffer.
+    void trim();
+
+  private:
+    struct Buffer
+    {
+      // The allocation, and the aligned buffer within it.
+      uint8_t* base;
+      uint8_t* data;
+      int width;
+      int height;
+      int stride;
+      PlutoVG_PixelFormat format;
+      // Pixels that may not be zero, of idle buffers.
+      PlutoVG_IRect dirty;
+    };
+
+    size_t bufferSize(const Buffer& buffer) const { return static_cast<size_t>(buffer.stride) * buffer.height; }
+    void evict(size_t maxIdleBytes);
+
+    std::mutex m_mutex;
+    // Released buffers, the most recently released last.
+    std::vector<Buffer> m_idle;
+    std::vector<Buffer> m_busy;
+    size_t m_idleBytes{0};
+    size_t m_maxIdleBytes;
+  };
+} // namespace rive
+
+#endif
@@ -145,31 +145,61 @@ namespace rive
     static plutovg_path_t* convert(const RawPath& rp)
     {
       plutovg_path_t* result = plutovg_path_create();
+      append(result, rp.verbs(), rp.points());
+      return result;
+    }
 
-      RawPath::Iter iter(rp);
-      while (auto rec = iter.next())
+    // Appends rive verbs to a plutovg path, walking the points along with them.
+    // Stops at the first verb short of points. plutovg has no way to reserve
+    // path storage, its arrays grow as elements are added.
+    static void append(plutovg_path_t* path, Span<const PathVerb> verbs, Span<const Vec2D> points)
+    {
+      const Vec2D* pts = points.data();
+      const Vec2D* end = pts + points.size();
+      for (const PathVerb verb : verbs)
       {
-        switch (rec.verb)
+        if (static_cast<size_t>(end - pts) < pointCount(verb))
+          return;
+
+        switch (verb)
         {
           case PathVerb::move:
-            plutovg_path_move_to(result, rec.pts[0].x, rec.pts[0].y);
+            plutovg_path_move_to(path, pts[0].x, pts[0].y);
+            pts += 1;
             break;
           case PathVerb::line:
-            plutovg_path_line_to(result, rec.pts[0].x, rec.pts[0].y);
+            plutovg_path_line_to(path, pts[0].x, pts[0].y);
+            pts += 1;
             break;
           case PathVerb::quad:
-            plutovg_path_quad_to(result, rec.pts[0].x, rec.pts[0].y, rec.pts[1].x, rec.pts[1].y);
+            plutovg_path_quad_to(path, pts[0].x, pts[0].y, pts[1].x, pts[1].y);
+            pts += 2;
             break;
           case PathVerb::cubic:
-            plutovg_path_cubic_to(result, rec.pts[0].x, rec.pts[0].y, rec.pts[1].x, rec.pts[1].y, rec.pts[2].x, rec.pts[2].y);
+            plutovg_path_cubic_to(path, pts[0].x, pts[0].y, pts[1].x, pts[1].y, pts[2].x, pts[2].y);
+            pts += 3;
             break;
           case PathVerb::close:
-            plutovg_path_close(result);
+            plutovg_path_close(path);
             break;
         }
       }
+    }
 
-      return result;
+    static size_t pointCount(PathVerb verb)
+    {
+      switch (verb)
+      {
+        case PathVerb::move:
+        case PathVerb::line:
+          return 1;
+        case PathVerb::quad:
+          return 2;
+        case PathVerb::cubic:
+          return 3;
+        default:
+          return 0;
+      }
     }
   };
 } // namespace rive
@@ -0,0 +1,47 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _PLUTONRIVER_YUV_CONVERTER_HPP_
+#define _PLUTONRIVER_YUV_CONVERTER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rive
+{
+  enum class PlutoVG_YUVLayout
+  {
+    // Y plane, then the U and V planes.
+    i420,
+    // Y plane, then a single interleaved UV plane.
+    nv12,
+  };
+
+  // Converts premultiplied ARGB32 surfaces to 4:2:0 BT.601 limited range YUV.
+  // Premultiplied colors are used as is, which is the frame composited over
+  // black, and chroma is the average of each 2x2 block.
+  class PlutoVG_YUVConverter
+  {
+  public:
+    // Size of a tightly packed frame, identical for both layouts.
+    static size_t frameSize(int width, int height);
+
+    // Writes a tightly packed frame of frameSize(width, height) bytes.
+    static void convert(PlutoVG_YUVLayout layout, const uint8_t* data, int width, int height, int stride, uint8_t* output);
+  };
+} // namespace rive
+
+#endif
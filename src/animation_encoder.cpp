@@ -0,0 +1,519 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <plutonriver/animation_encoder.hpp>
+
+#include <pixel_ops.hpp>
+
+#include <stb_image_write.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace rive;
+
+static const uint8_t kTransparentIndex = 255;
+
+static bool contains(const PlutoVG_IRect& rect, int x, int y)
+{
+  return x >= rect.x && x < rect.x + rect.width && y >= rect.y && y < rect.y + rect.height;
+}
+
+static void put16LE(std::vector<uint8_t>& output, int value)
+{
+  output.push_back(value & 255);
+  output.push_back(value >> 8 & 255);
+}
+
+static void put32BE(std::vector<uint8_t>& output, uint32_t value)
+{
+  output.push_back(value >> 24 & 255);
+  output.push_back(value >> 16 & 255);
+  output.push_back(value >> 8 & 255);
+  output.push_back(value & 255);
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+  static const auto table = []
+  {
+    std::vector<uint32_t> result(256);
+    for (uint32_t n = 0; n < 256; n++)
+    {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      result[n] = c;
+    }
+    return result;
+  }();
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+    crc = table[(crc ^ data[i]) & 255] ^ (crc >> 8);
+  return ~crc;
+}
+
+static void writeChunk(std::vector<uint8_t>& output, const char* type, const uint8_t* data, size_t size)
+{
+  put32BE(output, static_cast<uint32_t>(size));
+  const size_t start = output.size();
+  output.insert(output.end(), type, type + 4);
+  output.insert(output.end(), data, data + size);
+  put32BE(output, crc32(0, output.data() + start, size + 4));
+}
+
+static void appendToVector(void* context, void* data, int size)
+{
+  auto* output = static_cast<std::vector<uint8_t>*>(context);
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  output->insert(output->end(), bytes, bytes + size);
+}
+
+// GIF flavoured LZW, mirroring giflib's code size and table reset schedule.
+static void writeLZW(std::vector<uint8_t>& output, const uint8_t* indices, size_t count)
+{
+  const int clearCode = 256;
+  const int endCode = 257;
+
+  std::vector<int32_t> keys(8192);
+  std::vector<int16_t> codes(8192);
+
+  uint8_t block[256];
+  int blockSize = 0;
+  uint32_t bits = 0;
+  int bitCount = 0;
+  int codeSize = 9;
+  int nextCode = endCode + 1;
+
+  auto flushBlock = [&]()
+  {
+    if (blockSize == 0)
+      return;
+
+    output.push_back(static_cast<uint8_t>(blockSize));
+    output.insert(output.end(), block, block + blockSize);
+    blockSize = 0;
+  };
+
+  auto emit = [&](int code)
+  {
+    bits |= static_cast<uint32_t>(code) << bitCount;
+    bitCount += codeSize;
+    while (bitCount >= 8)
+    {
+      block[blockSize++] = bits & 255;
+      bits >>= 8;
+      bitCount -= 8;
+      if (blockSize == 255)
+        flushBlock();
+    }
+
+    if (nextCode >= (1 << codeSize) && codeSize < 12)
+      codeSize++;
+  };
+
+  auto resetTable = [&]()
+  {
+    std::fill(keys.begin(), keys.end(), -1);
+    codeSize = 9;
+    nextCode = endCode + 1;
+  };
+
+  output.push_back(8);
+  resetTable();
+  emit(clearCode);
+
+  int prefix = indices[0];
+  for (size_t i = 1; i < count; i++)
+  {
+    const int32_t key = prefix << 8 | indices[i];
+
+    size_t slot = (static_cast<uint32_t>(key) * 2654435761u >> 19) & 8191;
+    while (keys[slot] != -1 && keys[slot] != key)
+      slot = (slot + 1) & 8191;
+
+    if (keys[slot] == key)
+    {
+      prefix = codes[slot];
+      continue;
+    }
+
+    emit(prefix);
+    if (nextCode >= 4095)
+    {
+      emit(clearCode);
+      resetTable();
+    }
+    else
+    {
+      keys[slot] = key;
+      codes[slot] = static_cast<int16_t>(nextCode++);
+    }
+    prefix = indices[i];
+  }
+
+  emit(prefix);
+  emit(endCode);
+  if (bitCount > 0)
+  {
+    block[blockSize++] = bits & 255;
+    if (blockSize == 255)
+      flushBlock();
+  }
+  flushBlock();
+  output.push_back(0);
+}
+
+PlutoVG_AnimationEncoder::PlutoVG_AnimationEncoder(PlutoVG_AnimationFormat format, float fps, int loopCount)
+  : m_format(format)
+  , m_fps(fps > 0.0f ? fps : 30.0f)
+  , m_loopCount(loopCount)
+{
+}
+
+bool PlutoVG_AnimationEncoder::addFrame(PlutoVG_Renderer& renderer, const PlutoVG_IRect* damage)
+{
+  return addFrame(renderer.data(), renderer.width(), renderer.height(), renderer.stride(), damage);
+}
+
+bool PlutoVG_AnimationEncoder::addFrame(const uint8_t* data, int width, int height, int stride, const PlutoVG_IRect* damage)
+{
+  if (data == nullptr || width <= 0 || height <= 0)
+    return false;
+
+  if (m_width == 0)
+  {
+    m_width = width;
+    m_height = height;
+    m_pending.resize(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; y++)
+      memcpy(&m_pending[static_cast<size_t>(width) * y], data + static_cast<size_t>(stride) * y, width * 4);
+
+    // The first frame always covers the whole canvas.
+    m_pendingRect = {0, 0, width, height};
+    m_pendingCleared = m_pendingRect;
+    m_pendingStart = 0;
+    m_frameTicks = 1;
+    return true;
+  }
+
+  if (width != m_width || height != m_height)
+    return false;
+
+  PlutoVG_IRect area = {0, 0, width, height};
+  if (damage != nullptr)
+    area = area.intersected(*damage);
+
+  // Bounds of the changed pixels, and of the ones going from visible to
+  // transparent, which a GIF can only show by disposing of the previous frame.
+  int changedLeft = width, changedTop = height, changedRight = -1, changedBottom = -1;
+  int clearedLeft = width, clearedTop = height, clearedRight = -1, clearedBottom = -1;
+  for (int y = area.y; y < area.y + area.height; y++)
+  {
+    const auto* src = reinterpret_cast<const uint32_t*>(data + static_cast<size_t>(stride) * y);
+    const uint32_t* previous = &m_pending[static_cast<size_t>(width) * y];
+    if (memcmp(src + area.x, previous + area.x, area.width * 4) == 0)
+      continue;
+
+    for (int x = area.x; x < area.x + area.width; x++)
+    {
+      if (src[x] == previous[x])
+        continue;
+
+      changedLeft = std::min(changedLeft, x);
+      changedRight = std::max(changedRight, x);
+      changedTop = std::min(changedTop, y);
+      changedBottom = std::max(changedBottom, y);
+
+      if (src[x] >> 24 < 128 && previous[x] >> 24 >= 128)
+      {
+        clearedLeft = std::min(clearedLeft, x);
+        clearedRight = std::max(clearedRight, x);
+        clearedTop = std::min(clearedTop, y);
+        clearedBottom = std::max(clearedBottom, y);
+      }
+    }
+  }
+
+  if (changedRight < 0)
+  {
+    m_frameTicks++;
+    return true;
+  }
+
+  if (m_format == PlutoVG_AnimationFormat::gif && clearedRight >= 0)
+  {
+    m_pendingDisposes = true;
+    m_pendingRect = m_pendingRect.united({clearedLeft, clearedTop, clearedRight - clearedLeft + 1, clearedBottom - clearedTop + 1});
+  }
+
+  writePending();
+
+  const PlutoVG_IRect cleared = m_pendingDisposes ? m_pendingRect : PlutoVG_IRect{};
+
+  m_beforePending.swap(m_pending);
+  m_pending = m_beforePending;
+  for (int y = area.y; y < area.y + area.height; y++)
+    memcpy(&m_pending[static_cast<size_t>(width) * y + area.x], data + static_cast<size_t>(stride) * y + area.x * 4, area.width * 4);
+
+  m_pendingRect = PlutoVG_IRect{changedLeft, changedTop, changedRight - changedLeft + 1, changedBottom - changedTop + 1}.united(cleared);
+  m_pendingCleared = cleared;
+  m_pendingDisposes = false;
+  m_pendingStart = m_frameTicks++;
+  return true;
+}
+
+void PlutoVG_AnimationEncoder::repeatFrame()
+{
+  if (m_width != 0)
+    m_frameTicks++;
+}
+
+void PlutoVG_AnimationEncoder::writePending()
+{
+  if (m_format == PlutoVG_AnimationFormat::apng)
+    writePNGFrame();
+  else
+    writeGIFFrame();
+
+  m_writtenFrames++;
+}
+
+void PlutoVG_AnimationEncoder::writePNGFrame()
+{
+  const PlutoVG_IRect& rect = m_pendingRect;
+
+  std::vector<uint32_t> rgba(static_cast<size_t>(rect.width) * rect.height);
+  for (int y = 0; y < rect.height; y++)
+    PixelOps::argbToRGBA(&m_pending[static_cast<size_t>(m_width) * (rect.y + y) + rect.x], &rgba[static_cast<size_t>(rect.width) * y], rect.width);
+
+  std::vector<uint8_t> png;
+  stbi_write_png_to_func(appendToVector, &png, rect.width, rect.height, 4, rgba.data(), rect.width * 4);
+
+  // Frame delays are exact for integral frame rates, in milliseconds otherwise.
+  int delayNum, delayDen;
+  const int ticks = m_frameTicks - m_pendingStart;
+  if (m_fps == std::floor(m_fps) && m_fps <= 65535.0f)
+  {
+    delayNum = std::min(ticks, 65535);
+    delayDen = static_cast<int>(m_fps);
+  }
+  else
+  {
+    const long start = std::lround(m_pendingStart * 1000.0 / m_fps);
+    const long end = std::lround(m_frameTicks * 1000.0 / m_fps);
+    delayNum = static_cast<int>(std::min(end - start, 65535L));
+    delayDen = 1000;
+  }
+
+  std::vector<uint8_t> control;
+  put32BE(control, m_sequence++);
+  put32BE(control, rect.width);
+  put32BE(control, rect.height);
+  put32BE(control, rect.x);
+  put32BE(control, rect.y);
+  control.push_back(delayNum >> 8 & 255);
+  control.push_back(delayNum & 255);
+  control.push_back(delayDen >> 8 & 255);
+  control.push_back(delayDen & 255);
+  control.push_back(0); // APNG_DISPOSE_OP_NONE
+  control.push_back(0); // APNG_BLEND_OP_SOURCE
+  writeChunk(m_body, "fcTL", control.data(), control.size());
+
+  // Lift the compressed image data out of the single frame PNG, the first
+  // frame keeps its IDAT chunks, later ones are rewritten as fdAT.
+  for (size_t offset = 8; offset + 12 <= png.size();)
+  {
+    const uint32_t size = static_cast<uint32_t>(png[offset]) << 24 | png[offset + 1] << 16 | png[offset + 2] << 8 | png[offset + 3];
+    const uint8_t* type = &png[offset + 4];
+    if (memcmp(type, "IDAT", 4) == 0)
+    {
+      if (m_writtenFrames == 0)
+      {
+        m_body.insert(m_body.end(), png.begin() + offset, png.begin() + offset + 12 + size);
+      }
+      else
+      {
+        std::vector<uint8_t> frameData;
+        frameData.reserve(size + 4);
+        put32BE(frameData, m_sequence++);
+        frameData.insert(frameData.end(), type + 4, type + 4 + size);
+        writeChunk(m_body, "fdAT", frameData.data(), frameData.size());
+      }
+    }
+    offset += 12 + size;
+  }
+}
+
+void PlutoVG_AnimationEncoder::writeGIFFrame()
+{
+  const PlutoVG_IRect& rect = m_pendingRect;
+  const size_t pixelCount = static_cast<size_t>(rect.width) * rect.height;
+
+  // Pixels are either transparent (which keeps what the previous frame left
+  // behind), or one of 4096 4:4:4 color bins. A pixel can only keep the
+  // previous frame when the area was not cleared before this frame.
+  const uint16_t keep = 0xffff;
+  std::vector<uint16_t> bins(pixelCount);
+  std::vector<uint32_t> binCounts(4096);
+  std::vector<uint64_t> binSums(4096 * 3);
+  for (int y = 0; y < rect.height; y++)
+  {
+    const uint32_t* src = &m_pending[static_cast<size_t>(m_width) * (rect.y + y) + rect.x];
+    const uint32_t* before = m_beforePending.empty() ? nullptr : &m_beforePending[static_cast<size_t>(m_width) * (rect.y + y) + rect.x];
+    for (int x = 0; x < rect.width; x++)
+    {
+      uint16_t& bin = bins[static_cast<size_t>(rect.width) * y + x];
+      const uint32_t pixel = src[x];
+      const bool cleared = before == nullptr || contains(m_pendingCleared, rect.x + x, rect.y + y);
+      if (pixel >> 24 < 128 || (!cleared && pixel == before[x]))
+      {
+        bin = keep;
+        continue;
+      }
+
+      const uint32_t r = pixel >> 16 & 255;
+      const uint32_t g = pixel >> 8 & 255;
+      const uint32_t b = pixel & 255;
+      bin = static_cast<uint16_t>((r >> 4) << 8 | (g >> 4) << 4 | (b >> 4));
+      binCounts[bin]++;
+      binSums[bin * 3 + 0] += r;
+      binSums[bin * 3 + 1] += g;
+      binSums[bin * 3 + 2] += b;
+    }
+  }
+
+  // Popularity quantizer: the 255 most used bins become the palette, every
+  // other bin maps to its nearest palette entry.
+  std::vector<uint16_t> used;
+  for (uint16_t bin = 0; bin < 4096; bin++)
+  {
+    if (binCounts[bin] > 0)
+      used.push_back(bin);
+  }
+  if (used.size() > kTransparentIndex)
+  {
+    std::partial_sort(used.begin(), used.begin() + kTransparentIndex, used.end(), [&binCounts](uint16_t a, uint16_t b)
+      { return binCounts[a] > binCounts[b]; });
+  }
+
+  uint8_t palette[256 * 3] = {0};
+  std::vector<uint8_t> lookup(4096, 0);
+  const size_t paletteSize = std::min(used.size(), static_cast<size_t>(kTransparentIndex));
+  for (size_t i = 0; i < paletteSize; i++)
+  {
+    const uint16_t bin = used[i];
+    for (int c = 0; c < 3; c++)
+      palette[i * 3 + c] = static_cast<uint8_t>(binSums[bin * 3 + c] / binCounts[bin]);
+    lookup[bin] = static_cast<uint8_t>(i);
+  }
+  for (size_t i = paletteSize; i < used.size(); i++)
+  {
+    const uint16_t bin = used[i];
+    int best = 0, bestDistance = 1 << 30;
+    for (size_t j = 0; j < paletteSize; j++)
+    {
+      int distance = 0;
+      for (int c = 0; c < 3; c++)
+      {
+        const int delta = static_cast<int>(binSums[bin * 3 + c] / binCounts[bin]) - palette[j * 3 + c];
+        distance += delta * delta;
+      }
+      if (distance < bestDistance)
+      {
+        bestDistance = distance;
+        best = static_cast<int>(j);
+      }
+    }
+    lookup[bin] = static_cast<uint8_t>(best);
+  }
+
+  std::vector<uint8_t> indices(pixelCount);
+  for (size_t i = 0; i < pixelCount; i++)
+    indices[i] = bins[i] == keep ? kTransparentIndex : lookup[bins[i]];
+
+  const long start = std::lround(m_pendingStart * 100.0 / m_fps);
+  const long end = std::lround(m_frameTicks * 100.0 / m_fps);
+  const int delay = static_cast<int>(std::min(end - start, 65535L));
+
+  // Graphic control extension: disposal, delay and transparent index.
+  m_body.insert(m_body.end(), {0x21, 0xf9, 0x04});
+  m_body.push_back(static_cast<uint8_t>((m_pendingDisposes ? 2 : 1) << 2 | 1));
+  put16LE(m_body, delay);
+  m_body.push_back(kTransparentIndex);
+  m_body.push_back(0);
+
+  // Image descriptor with a 256 entry local color table.
+  m_body.push_back(0x2c);
+  put16LE(m_body, rect.x);
+  put16LE(m_body, rect.y);
+  put16LE(m_body, rect.width);
+  put16LE(m_body, rect.height);
+  m_body.push_back(0x87);
+  m_body.insert(m_body.end(), palette, palette + sizeof(palette));
+
+  writeLZW(m_body, indices.data(), indices.size());
+}
+
+std::vector<uint8_t> PlutoVG_AnimationEncoder::finish()
+{
+  std::vector<uint8_t> output;
+  if (m_width == 0)
+    return output;
+
+  writePending();
+
+  if (m_format == PlutoVG_AnimationFormat::apng)
+  {
+    const uint8_t signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    output.insert(output.end(), signature, signature + sizeof(signature));
+
+    std::vector<uint8_t> header;
+    put32BE(header, m_width);
+    put32BE(header, m_height);
+    header.insert(header.end(), {8, 6, 0, 0, 0}); // 8 bit RGBA, not interlaced
+    writeChunk(output, "IHDR", header.data(), header.size());
+
+    std::vector<uint8_t> control;
+    put32BE(control, m_writtenFrames);
+    put32BE(control, m_loopCount);
+    writeChunk(output, "acTL", control.data(), control.size());
+
+    output.insert(output.end(), m_body.begin(), m_body.end());
+    writeChunk(output, "IEND", nullptr, 0);
+  }
+  else
+  {
+    output.insert(output.end(), {'G', 'I', 'F', '8', '9', 'a'});
+    put16LE(output, m_width);
+    put16LE(output, m_height);
+    output.insert(output.end(), {0, 0, 0}); // no global color table
+
+    const char* netscape = "NETSCAPE2.0";
+    output.insert(output.end(), {0x21, 0xff, 0x0b});
+    output.insert(output.end(), netscape, netscape + 11);
+    output.insert(output.end(), {0x03, 0x01});
+    put16LE(output, m_loopCount);
+    output.push_back(0);
+
+    output.insert(output.end(), m_body.begin(), m_body.end());
+    output.push_back(0x3b);
+  }
+
+  m_body.clear();
+  m_width = m_height = 0;
+  return output;
+}
@@ -0,0 +1,548 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <coverage_rasterizer.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+using namespace rive;
+
+// Flattening tolerance, in device pixels.
+static const float kTolerance = 0.1f;
+// Most segments a curve or a circle is flattened into.
+static const int kMaxSegments = 256;
+
+static Vec2D add(Vec2D a, Vec2D b)
+{
+  return Vec2D(a.x + b.x, a.y + b.y);
+}
+
+static Vec2D sub(Vec2D a, Vec2D b)
+{
+  return Vec2D(a.x - b.x, a.y - b.y);
+}
+
+static Vec2D scale(Vec2D a, float s)
+{
+  return Vec2D(a.x * s, a.y * s);
+}
+
+static float cross(Vec2D a, Vec2D b)
+{
+  return a.x * b.y - a.y * b.x;
+}
+
+static float dot(Vec2D a, Vec2D b)
+{
+  return a.x * b.x + a.y * b.y;
+}
+
+// Unit vector along `a`, which is never zero: contours drop repeated points.
+static Vec2D unit(Vec2D a)
+{
+  return scale(a, 1.0f / std::sqrt(dot(a, a)));
+}
+
+// Rotated a quarter turn.
+static Vec2D perpendicular(Vec2D a)
+{
+  return Vec2D(-a.y, a.x);
+}
+
+// Longest axis of the transform.
+static float maxScale(const Mat2D& matrix)
+{
+  const float scale = std::max(std::sqrt(matrix[0] * matrix[0] + matrix[1] * matrix[1]), std::sqrt(matrix[2] * matrix[2] + matrix[3] * matrix[3]));
+  return scale > 1e-6f ? scale : 1e-6f;
+}
+
+// `value` / 255, rounded.
+static uint32_t div255(uint32_t value)
+{
+  value += 128;
+  return (value + (value >> 8)) >> 8;
+}
+
+void CoverageRasterizer::reset(const PlutoVG_IRect& area)
+{
+  // Cells are zeroed again as they are composited, a shape that was never
+  // composited leaves them to clear here.
+  if (m_firstRow < m_lastRow)
+    std::fill(m_cells.begin(), m_cells.end(), 0.0f);
+
+  m_area = area;
+  const size_t size = static_cast<size_t>(area.width + 2) * area.height;
+  if (m_cells.size() < size)
+    m_cells.resize(size, 0.0f);
+  m_firstRow = area.height;
+  m_lastRow = 0;
+}
+
+void CoverageRasterizer::fillPath(const plutovg_path_t* path, const Mat2D& matrix)
+{
+  m_matrix = matrix;
+  flatten(path, kTolerance / maxScale(matrix), false);
+}
+
+void CoverageRasterizer::strokePath(const plutovg_path_t* path, const Mat2D& matrix, float width, plutovg_line_cap_t cap, plutovg_line_join_t join, float miterLimit)
+{
+  if (!(width > 0.0f))
+    return;
+
+  m_matrix = matrix;
+  m_halfWidth = width * 0.5f;
+  m_cap = cap;
+  m_join = join;
+  m_miterLimit = miterLimit;
+
+  // Each segment of a circle strays 1 - cos(angle / 2) radii from it.
+  const float scale = maxScale(matrix);
+  const float radius = m_halfWidth * scale;
+  int segments = 8;
+  if (radius > kTolerance)
+    segments = std::min(std::max(static_cast<int>(std::ceil(3.14159265f / std::acos(1.0f - kTolerance / radius))), 8), kMaxSegments);
+  if (segments != m_circleSegments || m_circle.empty() || m_circle[0].x != m_halfWidth)
+  {
+    m_circleSegments = segments;
+    m_circle.resize(segments);
+    for (int i = 0; i < segments; i++)
+    {
+      const float angle = 6.28318531f * i / segments;
+      m_circle[i] = Vec2D(m_halfWidth * std::cos(angle), m_halfWidth * std::sin(angle));
+    }
+  }
+
+  flatten(path, kTolerance / scale, true);
+}
+
+void CoverageRasterizer::fillPolygon(const Vec2D* points, size_t count, const Mat2D& matrix)
+{
+  m_matrix = matrix;
+  addPolygon(points, count, false);
+}
+
+// Contours are flattened in user space, with the tolerance scaled down by the
+// transform, so that strokes are outlined with their user space width.
+void CoverageRasterizer::flatten(const plutovg_path_t* path, float tolerance, bool stroke)
+{
+  const int elementCount = plutovg_path_get_element_count(path);
+  const plutovg_path_element_t* elements = plutovg_path_get_elements(path);
+  const plutovg_point_t* points = plutovg_path_get_points(path);
+
+  // Points this close to the previous one are dropped, which leaves every
+  // segment a direction.
+  const float minDistance = tolerance * 1e-3f;
+  auto lineTo = [&](Vec2D point)
+  {
+    const Vec2D delta = sub(point, m_contour.back());
+    if (dot(delta, delta) > minDistance * minDistance)
+      m_contour.push_back(point);
+  };
+  auto toVec = [](const plutovg_point_t& point) { return Vec2D(static_cast<float>(point.x), static_cast<float>(point.y)); };
+
+  // Whether the contour has segments: a lone move draws nothing, a close
+  // leaves the pen on the start point for the segments that follow.
+  bool drawn = false;
+  Vec2D start(0.0f, 0.0f);
+  m_contour.clear();
+  m_contour.push_back(start);
+
+  for (int i = 0; i < elementCount; i++)
+  {
+    switch (elements[i])
+    {
+      case plutovg_path_element_move_to:
+        if (drawn)
+          endContour(false, stroke);
+        drawn = false;
+        start = toVec(points[0]);
+        m_contour.clear();
+        m_contour.push_back(start);
+        points += 1;
+        break;
+
+      case plutovg_path_element_line_to:
+        lineTo(toVec(points[0]));
+        drawn = true;
+        points += 1;
+        break;
+
+      case plutovg_path_element_cubic_to:
+      {
+        const Vec2D p0 = m_contour.back();
+        const Vec2D p1 = toVec(points[0]);
+        const Vec2D p2 = toVec(points[1]);
+        const Vec2D p3 = toVec(points[2]);
+
+        // Wang's formula: segments of 1 / n of the parameter stay within the
+        // tolerance of a cubic whose second differences are at most `dd`.
+        const Vec2D d0 = add(sub(p0, scale(p1, 2.0f)), p2);
+        const Vec2D d1 = add(sub(p1, scale(p2, 2.0f)), p3);
+        const float dd = std::sqrt(std::max(dot(d0, d0), dot(d1, d1)));
+        const float estimate = std::ceil(std::sqrt(0.75f * dd / tolerance));
+        const int segments = estimate >= 1.0f ? static_cast<int>(std::min(estimate, static_cast<float>(kMaxSegments))) : 1;
+        for (int j = 1; j < segments; j++)
+        {
+          const float t = static_cast<float>(j) / segments;
+          const float u = 1.0f - t;
+          const float a = u * u * u, b = 3.0f * u * u * t, c = 3.0f * u * t * t, d = t * t * t;
+          lineTo(Vec2D(a * p0.x + b * p1.x + c * p2.x + d * p3.x, a * p0.y + b * p1.y + c * p2.y + d * p3.y));
+        }
+        lineTo(p3);
+        drawn = true;
+        points += 3;
+        break;
+      }
+
+      case plutovg_path_element_close:
+        if (drawn)
+          endContour(true, stroke);
+        drawn = false;
+        m_contour.clear();
+        m_contour.push_back(start);
+        points += 1;
+        break;
+    }
+  }
+
+  if (drawn)
+    endContour(false, stroke);
+}
+
+void CoverageRasterizer::endContour(bool closed, bool stroke)
+{
+  if (stroke)
+    strokeContour(m_contour.data(), m_contour.size(), closed);
+  else
+    addPolygon(m_contour.data(), m_contour.size(), false);
+}
+
+// Strokes are the union of a quad along each segment, and of the joins and
+// caps, each one added with the same orientation so that their windings add
+// up where they overlap and the nonzero rule keeps them all.
+void CoverageRasterizer::strokeContour(const Vec2D* points, size_t count, bool closed)
+{
+  if (closed && count > 1 && points[count - 1].x == points[0].x && points[count - 1].y == points[0].y)
+    count--;
+
+  const float r = m_halfWidth;
+  if (count == 1)
+  {
+    // Zero-length contours are only seen through their caps.
+    if (closed)
+      return;
+
+    const Vec2D point = points[0];
+    if (m_cap == plutovg_line_cap_round)
+    {
+      addCircle(point);
+    }
+    else if (m_cap == plutovg_line_cap_square)
+    {
+      const Vec2D square[] = {Vec2D(point.x - r, point.y - r), Vec2D(point.x + r, point.y - r), Vec2D(point.x + r, point.y + r), Vec2D(point.x - r, point.y + r)};
+      addPolygon(square, 4, true);
+    }
+    return;
+  }
+
+  const size_t segments = closed ? count : count - 1;
+  for (size_t i = 0; i < segments; i++)
+  {
+    const Vec2D from = points[i];
+    const Vec2D to = points[(i + 1) % count];
+    const Vec2D normal = scale(perpendicular(unit(sub(to, from))), r);
+    const Vec2D quad[] = {add(from, normal), add(to, normal), sub(to, normal), sub(from, normal)};
+    addPolygon(quad, 4, true);
+  }
+
+  const size_t firstJoin = closed ? 0 : 1;
+  const size_t lastJoin = closed ? count : count - 1;
+  for (size_t i = firstJoin; i < lastJoin; i++)
+    addJoin(points[(i + count - 1) % count], points[i], points[(i + 1) % count]);
+
+  if (!closed)
+  {
+    addCap(points[1], points[0]);
+    addCap(points[count - 2], points[count - 1]);
+  }
+}
+
+// Fills the gap the quads of two segments leave on the outer side of the
+// point they meet at.
+void CoverageRasterizer::addJoin(Vec2D previous, Vec2D point, Vec2D next)
+{
+  if (m_join == plutovg_line_join_round)
+  {
+    addCircle(point);
+    return;
+  }
+
+  const Vec2D d0 = unit(sub(point, previous));
+  const Vec2D d1 = unit(sub(next, point));
+  const float turn = cross(d0, d1);
+  const float cosine = dot(d0, d1);
+  if (std::abs(turn) < 1e-6f && cosine > 0.0f)
+    return;
+
+  // Segments turning towards their normal leave the gap on the other side.
+  const float side = turn > 0.0f ? -m_halfWidth : m_halfWidth;
+  const Vec2D n0 = scale(perpendicular(d0), side);
+  const Vec2D n1 = scale(perpendicular(d1), side);
+  const Vec2D a = add(point, n0);
+  const Vec2D b = add(point, n1);
+
+  // The miter tip lies 1 / cos(half the turn) half widths from the point.
+  if (m_join == plutovg_line_join_miter && cosine > -1.0f && 1.0f / std::sqrt((1.0f + cosine) * 0.5f) <= m_miterLimit)
+  {
+    const Vec2D tip = add(point, scale(add(n0, n1), 1.0f / (1.0f + cosine)));
+    const Vec2D miter[] = {point, a, tip, b};
+    addPolygon(miter, 4, true);
+    return;
+  }
+
+  const Vec2D bevel[] = {point, a, b};
+  addPolygon(bevel, 3, true);
+}
+
+// Caps the contour at `end`, the segment reaching it coming from `from`.
+void CoverageRasterizer::addCap(Vec2D from, Vec2D end)
+{
+  if (m_cap == plutovg_line_cap_round)
+  {
+    addCircle(end);
+  }
+  else if (m_cap == plutovg_line_cap_square)
+  {
+    const Vec2D direction = scale(unit(sub(end, from)), m_halfWidth);
+    const Vec2D normal = perpendicular(direction);
+    const Vec2D tip = add(end, direction);
+    const Vec2D square[] = {add(end, normal), add(tip, normal), sub(tip, normal), sub(end, normal)};
+    addPolygon(square, 4, true);
+  }
+}
+
+void CoverageRasterizer::addCircle(Vec2D center)
+{
+  m_polygon.resize(m_circle.size());
+  for (size_t i = 0; i < m_circle.size(); i++)
+    m_polygon[i] = m_matrix * add(center, m_circle[i]);
+  addEdges(true);
+}
+
+void CoverageRasterizer::addPolygon(const Vec2D* points, size_t count, bool orient)
+{
+  m_polygon.resize(count);
+  for (size_t i = 0; i < count; i++)
+    m_polygon[i] = m_matrix * points[i];
+  addEdges(orient);
+}
+
+// Adds the edges of the device polygon in m_polygon, reversed when `orient`
+// is set and it winds negatively.
+void CoverageRasterizer::addEdges(bool orient)
+{
+  const size_t count = m_polygon.size();
+  if (count < 3)
+    return;
+
+  bool reverse = false;
+  if (orient)
+  {
+    float area = 0.0f;
+    for (size_t i = 0; i < count; i++)
+      area += cross(m_polygon[i], m_polygon[(i + 1) % count]);
+    reverse = area < 0.0f;
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    const Vec2D& from = m_polygon[i];
+    const Vec2D& to = m_polygon[(i + 1) % count];
+    if (reverse)
+      addEdge(to, from);
+    else
+      addEdge(from, to);
+  }
+}
+
+// Parts of the edge left or right of the area are pushed onto its side: they
+// still change the winding of the pixels right of them, but none of their
+// coverage.
+void CoverageRasterizer::addEdge(Vec2D from, Vec2D to)
+{
+  const float x0 = from.x - m_area.x, y0 = from.y - m_area.y;
+  const float x1 = to.x - m_area.x, y1 = to.y - m_area.y;
+  if (y0 == y1 || !std::isfinite(x0 + y0 + x1 + y1))
+    return;
+
+  const float width = static_cast<float>(m_area.width);
+  float splits[3];
+  int count = 0;
+  if (x0 != x1)
+  {
+    for (const float side : {0.0f, width})
+    {
+      const float t = (side - x0) / (x1 - x0);
+      if (t > 0.0f && t < 1.0f)
+        splits[count++] = t;
+    }
+    if (count == 2 && splits[0] > splits[1])
+      std::swap(splits[0], splits[1]);
+  }
+  splits[count++] = 1.0f;
+
+  auto clampX = [width](float x) { return std::min(std::max(x, 0.0f), width); };
+  float x = x0, y = y0;
+  for (int i = 0; i < count; i++)
+  {
+    const bool last = i == count - 1;
+    const float nextX = last ? x1 : x0 + (x1 - x0) * splits[i];
+    const float nextY = last ? y1 : y0 + (y1 - y0) * splits[i];
+    accumulate(clampX(x), y, clampX(nextX), nextY);
+    x = nextX;
+    y = nextY;
+  }
+}
+
+// Adds the signed area an edge within [0, width] covers in each cell it
+// crosses, and carries the rest to the next cell, so that summing a row from
+// the left gives the coverage of each pixel.
+void CoverageRasterizer::accumulate(float x0, float y0, float x1, float y1)
+{
+  if (y0 == y1)
+    return;
+
+  float direction = 1.0f;
+  if (y0 > y1)
+  {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+    direction = -1.0f;
+  }
+
+  const float height = static_cast<float>(m_area.height);
+  if (y1 <= 0.0f || y0 >= height)
+    return;
+
+  const float width = static_cast<float>(m_area.width);
+  const float dxdy = (x1 - x0) / (y1 - y0);
+  float x = x0;
+  if (y0 < 0.0f)
+  {
+    x -= y0 * dxdy;
+    y0 = 0.0f;
+  }
+
+  const int firstRow = static_cast<int>(y0);
+  const int lastRow = std::min(m_area.height, static_cast<int>(std::ceil(y1)));
+  m_firstRow = std::min(m_firstRow, firstRow);
+  m_lastRow = std::max(m_lastRow, lastRow);
+
+  const size_t stride = static_cast<size_t>(m_area.width) + 2;
+  for (int y = firstRow; y < lastRow; y++)
+  {
+    float* row = m_cells.data() + stride * y;
+    const float dy = std::min(static_cast<float>(y + 1), y1) - std::max(static_cast<float>(y), y0);
+    const float nextX = std::min(std::max(x + dxdy * dy, 0.0f), width);
+    const float d = dy * direction;
+
+    const float left = std::min(x, nextX);
+    const float right = std::max(x, nextX);
+    const float leftFloor = std::floor(left);
+    const int leftCell = static_cast<int>(leftFloor);
+    const float rightCeil = std::ceil(right);
+    const int rightCell = static_cast<int>(rightCeil);
+
+    if (rightCell <= leftCell + 1)
+    {
+      // Within one cell: the part left of the edge's mean x is uncovered.
+      const float middle = 0.5f * (x + nextX) - leftFloor;
+      row[leftCell] += d - d * middle;
+      row[leftCell + 1] += d * middle;
+    }
+    else
+    {
+      // Across cells: a triangle in the first and last cells, a constant
+      // slope through the ones between.
+      const float s = 1.0f / (right - left);
+      const float leftFraction = left - leftFloor;
+      const float firstArea = 0.5f * s * (1.0f - leftFraction) * (1.0f - leftFraction);
+      const float rightFraction = right - rightCeil + 1.0f;
+      const float lastArea = 0.5f * s * rightFraction * rightFraction;
+
+      row[leftCell] += d * firstArea;
+      if (rightCell == leftCell + 2)
+      {
+        row[leftCell + 1] += d * (1.0f - firstArea - lastArea);
+      }
+      else
+      {
+        const float secondArea = s * (1.5f - leftFraction);
+        row[leftCell + 1] += d * (secondArea - firstArea);
+        for (int cell = leftCell + 2; cell < rightCell - 1; cell++)
+          row[cell] += d * s;
+        const float beforeLast = secondArea + (rightCell - leftCell - 3) * s;
+        row[rightCell - 1] += d * (1.0f - beforeLast - lastArea);
+      }
+      row[rightCell] += d * lastArea;
+    }
+
+    x = nextX;
+  }
+}
+
+void CoverageRasterizer::composite(plutovg_fill_rule_t fillRule, uint8_t* data, int stride, const uint8_t* mask, int maskStride)
+{
+  const int width = m_area.width;
+  const size_t cellStride = static_cast<size_t>(width) + 2;
+  for (int y = m_firstRow; y < m_lastRow; y++)
+  {
+    float* cells = m_cells.data() + cellStride * y;
+    uint8_t* dst = data + static_cast<size_t>(stride) * y;
+    const uint8_t* maskRow = mask != nullptr ? mask + static_cast<size_t>(maskStride) * y : nullptr;
+
+    float winding = 0.0f;
+    for (int x = 0; x < width; x++)
+    {
+      winding += cells[x];
+      cells[x] = 0.0f;
+
+      float coverage = std::abs(winding);
+      if (fillRule == plutovg_fill_rule_even_odd)
+      {
+        coverage -= 2.0f * std::floor(coverage * 0.5f);
+        if (coverage > 1.0f)
+          coverage = 2.0f - coverage;
+      }
+      else if (coverage > 1.0f)
+      {
+        coverage = 1.0f;
+      }
+
+      uint32_t value = static_cast<uint32_t>(coverage * 255.0f + 0.5f);
+      if (maskRow != nullptr)
+        value = div255(value * maskRow[x]);
+      if (value == 255)
+        dst[x] = 255;
+      else if (value != 0)
+        dst[x] = static_cast<uint8_t>(value + div255(dst[x] * (255 - value)));
+    }
+    cells[width] = 0.0f;
+    cells[width + 1] = 0.0f;
+  }
+
+  m_firstRow = m_area.height;
+  m_lastRow = 0;
+}
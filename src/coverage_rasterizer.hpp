@@ -0,0 +1,99 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _PLUTONRIVER_COVERAGE_RASTERIZER_HPP_
+#define _PLUTONRIVER_COVERAGE_RASTERIZER_HPP_
+
+#include <rive/math/mat2d.hpp>
+#include <rive/math/vec2d.hpp>
+
+#include <plutonriver/renderer.hpp>
+
+#include <plutovg.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rive
+{
+  // Rasterizes shapes into 8-bit coverage for a8 targets, which keep nothing
+  // else: no paint, shader or image is ever looked at, and no ARGB32 pixel is
+  // written. Edges add their signed area to an accumulation buffer over the
+  // pixels of the draw, whose running sum along each row is the winding
+  // weighted coverage of every pixel.
+  class CoverageRasterizer
+  {
+  public:
+    // Starts a shape, rasterized over the device pixels of `area` only.
+    void reset(const PlutoVG_IRect& area);
+
+    // Adds the contours of a path, transformed by `matrix`. Contours are
+    // closed implicitly.
+    void fillPath(const plutovg_path_t* path, const Mat2D& matrix);
+    // Adds the outline of a path stroked in user space, transformed by
+    // `matrix`. Miter joins reaching further than `miterLimit` half widths
+    // are beveled.
+    void strokePath(const plutovg_path_t* path, const Mat2D& matrix, float width, plutovg_line_cap_t cap, plutovg_line_join_t join, float miterLimit);
+    // Adds a closed polygon in user space.
+    void fillPolygon(const Vec2D* points, size_t count, const Mat2D& matrix);
+
+    // Composites the coverage of the shape source over into the 8-bit pixels
+    // of the area, `data` pointing at its first one, scaled by the mask in
+    // `mask` when there is one, laid out the same way. Leaves the rasterizer
+    // ready for the next shape.
+    void composite(plutovg_fill_rule_t fillRule, uint8_t* data, int stride, const uint8_t* mask, int maskStride);
+
+  private:
+    void addEdge(Vec2D from, Vec2D to);
+    void accumulate(float x0, float y0, float x1, float y1);
+    void flatten(const plutovg_path_t* path, float tolerance, bool stroke);
+    void endContour(bool closed, bool stroke);
+    void addPolygon(const Vec2D* points, size_t count, bool orient);
+    void addEdges(bool orient);
+    void addCircle(Vec2D center);
+    void addJoin(Vec2D previous, Vec2D point, Vec2D next);
+    void addCap(Vec2D from, Vec2D end);
+    void strokeContour(const Vec2D* points, size_t count, bool closed);
+
+    PlutoVG_IRect m_area;
+    // (width + 2) cells per row: edges pushed onto the right side of the area
+    // spill past it.
+    std::vector<float> m_cells;
+    // Rows edges were added to, [m_firstRow, m_lastRow).
+    int m_firstRow{0};
+    int m_lastRow{0};
+
+    // The contour being flattened in user space, the offsets of the points of
+    // round joins and caps from their center, and the device points of the
+    // polygon being added.
+    std::vector<Vec2D> m_contour;
+    std::vector<Vec2D> m_circle;
+    std::vector<Vec2D> m_polygon;
+
+    // Stroke parameters, in user space, and the transform of the shape.
+    Mat2D m_matrix;
+    float m_halfWidth{0.0f};
+    plutovg_line_cap_t m_cap{plutovg_line_cap_butt};
+    plutovg_line_join_t m_join{plutovg_line_join_miter};
+    float m_miterLimit{0.0f};
+    // Segments of full circles, enough to stay within the flattening
+    // tolerance once transformed.
+    int m_circleSegments{8};
+  };
+} // namespace rive
+
+#endif
@@ -0,0 +1,122 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <plutonriver/mapped_file.hpp>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace rive;
+
+#ifdef _WIN32
+
+std::unique_ptr<PlutonRiver_MappedFile> PlutonRiver_MappedFile::open(const char* path)
+{
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return nullptr;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size))
+  {
+    CloseHandle(file);
+    return nullptr;
+  }
+
+  std::unique_ptr<PlutonRiver_MappedFile> result(new PlutonRiver_MappedFile());
+  if (size.QuadPart == 0)
+  {
+    CloseHandle(file);
+    return result;
+  }
+
+  // The mapping object keeps the file alive, the handle is not needed anymore.
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr)
+    return nullptr;
+
+  const void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (data == nullptr)
+  {
+    CloseHandle(mapping);
+    return nullptr;
+  }
+
+  result->m_data = static_cast<const uint8_t*>(data);
+  result->m_size = static_cast<size_t>(size.QuadPart);
+  result->m_mapping = mapping;
+  return result;
+}
+
+PlutonRiver_MappedFile::~PlutonRiver_MappedFile()
+{
+  if (m_data != nullptr)
+    UnmapViewOfFile(m_data);
+  if (m_mapping != nullptr)
+    CloseHandle(m_mapping);
+}
+
+#else
+
+std::unique_ptr<PlutonRiver_MappedFile> PlutonRiver_MappedFile::open(const char* path)
+{
+  const int fd = ::open(path, O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0)
+  {
+    close(fd);
+    return nullptr;
+  }
+
+  std::unique_ptr<PlutonRiver_MappedFile> result(new PlutonRiver_MappedFile());
+  if (info.st_size == 0)
+  {
+    close(fd);
+    return result;
+  }
+
+  const size_t size = static_cast<size_t>(info.st_size);
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return nullptr;
+
+  // The importer reads the file front to back exactly once: ask for aggressive
+  // read-ahead and let the kernel drop pages behind the reader.
+  madvise(data, size, MADV_SEQUENTIAL);
+  madvise(data, size, MADV_WILLNEED);
+
+  result->m_data = static_cast<const uint8_t*>(data);
+  result->m_size = size;
+  return result;
+}
+
+PlutonRiver_MappedFile::~PlutonRiver_MappedFile()
+{
+  if (m_data != nullptr)
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+}
+
+#endif
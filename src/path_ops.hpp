@@ -0,0 +1,101 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _PLUTONRIVER_PATH_OPS_HPP_
+#define _PLUTONRIVER_PATH_OPS_HPP_
+
+#include <rive/math/mat2d.hpp>
+#include <rive/math/vec2d.hpp>
+
+#include <plutonriver/renderer.hpp>
+
+#include <pixel_ops.hpp>
+
+#include <cstddef>
+
+namespace rive
+{
+  // Point helpers for building paths, specialized by the class of transform.
+  class PathOps
+  {
+  public:
+    static PlutoVG_MatrixType classify(const Mat2D& matrix)
+    {
+      if (matrix[1] != 0.0f || matrix[2] != 0.0f)
+        return PlutoVG_MatrixType::affine;
+      if (matrix[0] != 1.0f || matrix[3] != 1.0f)
+        return PlutoVG_MatrixType::scaleTranslate;
+      if (matrix[4] != 0.0f || matrix[5] != 0.0f)
+        return PlutoVG_MatrixType::translate;
+      return PlutoVG_MatrixType::identity;
+    }
+
+    // Transforms `count` points, `src` and `dst` may be the same. Two points
+    // fill an SSE register, four are transformed per iteration, in the same
+    // order of operations as Mat2D * Vec2D.
+    static void transform(const Vec2D* src, Vec2D* dst, size_t count, const Mat2D& matrix, PlutoVG_MatrixType type)
+    {
+      static_assert(sizeof(Vec2D) == 2 * sizeof(float), "points are pairs of floats");
+      if (type == PlutoVG_MatrixType::identity)
+      {
+        if (src != dst)
+          memcpy(dst, src, count * sizeof(Vec2D));
+        return;
+      }
+
+      size_t i = 0;
+#ifdef PLUTONRIVER_SSE2
+      const auto* in = reinterpret_cast<const float*>(src);
+      auto* out = reinterpret_cast<float*>(dst);
+      const __m128 translate = _mm_setr_ps(matrix[4], matrix[5], matrix[4], matrix[5]);
+      const __m128 scale = _mm_setr_ps(matrix[0], matrix[3], matrix[0], matrix[3]);
+      const __m128 skew = _mm_setr_ps(matrix[2], matrix[1], matrix[2], matrix[1]);
+      for (; i + 4 <= count; i += 4)
+      {
+        __m128 a = _mm_loadu_ps(in + i * 2);
+        __m128 b = _mm_loadu_ps(in + i * 2 + 4);
+        switch (type)
+        {
+          case PlutoVG_MatrixType::translate:
+            a = _mm_add_ps(a, translate);
+            b = _mm_add_ps(b, translate);
+            break;
+          case PlutoVG_MatrixType::scaleTranslate:
+            a = _mm_add_ps(_mm_mul_ps(a, scale), translate);
+            b = _mm_add_ps(_mm_mul_ps(b, scale), translate);
+            break;
+          default:
+          {
+            // x' = xx * x + yx * y, y' = yy * y + xy * x: the swapped pair
+            // (y, x) brings the cross terms in line.
+            const __m128 swappedA = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+            const __m128 swappedB = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1));
+            a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a, scale), _mm_mul_ps(swappedA, skew)), translate);
+            b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b, scale), _mm_mul_ps(swappedB, skew)), translate);
+            break;
+          }
+        }
+        _mm_storeu_ps(out + i * 2, a);
+        _mm_storeu_ps(out + i * 2 + 4, b);
+      }
+#endif
+      for (; i < count; i++)
+        dst[i] = matrix * src[i];
+    }
+  };
+} // namespace rive
+
+#endif
@@ -0,0 +1,187 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _PLUTONRIVER_PIXEL_OPS_HPP_
+#define _PLUTONRIVER_PIXEL_OPS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PLUTONRIVER_SSE2
+#endif
+
+namespace rive
+{
+  // Pixel conversion helpers shared by the renderer and the encoders. Surface
+  // pixels are plutovg's native premultiplied ARGB32 words.
+  class PixelOps
+  {
+  public:
+    // Zeroes `size` bytes. The C library's memset is already vectorized and
+    // switches to non-temporal stores for large sizes.
+    static void clear(uint8_t* data, size_t size)
+    {
+      memset(data, 0, size);
+    }
+
+    // Zeroes `rowBytes` bytes of `rows` rows `stride` bytes apart. Areas larger
+    // than the caches are written with non-temporal stores, which skip reading
+    // the lines in and do not evict the working set.
+    static void clearRows(uint8_t* data, int stride, int rowBytes, int rows)
+    {
+      if (rowBytes == stride)
+      {
+        clearStreaming(data, static_cast<size_t>(stride) * rows);
+        return;
+      }
+
+      const bool streaming = static_cast<size_t>(rowBytes) * rows >= kStreamingThreshold;
+      for (int y = 0; y < rows; y++)
+      {
+        uint8_t* row = data + static_cast<size_t>(stride) * y;
+        if (streaming)
+          streamZero(row, rowBytes);
+        else
+          memset(row, 0, rowBytes);
+      }
+#ifdef PLUTONRIVER_SSE2
+      if (streaming)
+        _mm_sfence();
+#endif
+    }
+
+    // ARGB32 words to R, G, B, A bytes.
+    static void argbToRGBA(const uint32_t* src, uint32_t* dst, int count)
+    {
+      auto* bytes = reinterpret_cast<uint8_t*>(dst);
+      for (int x = 0; x < count; x++)
+      {
+        bytes[x * 4 + 0] = src[x] >> 16 & 255;
+        bytes[x * 4 + 1] = src[x] >> 8 & 255;
+        bytes[x * 4 + 2] = src[x] >> 0 & 255;
+        bytes[x * 4 + 3] = src[x] >> 24;
+      }
+    }
+
+    // Exchanges the red and blue channels, `src` and `dst` may be the same.
+    static void swapRedBlue(const uint32_t* src, uint32_t* dst, int count)
+    {
+      for (int x = 0; x < count; x++)
+      {
+        const uint32_t pixel = src[x];
+        dst[x] = (pixel & 0xff00ff00) | (pixel >> 16 & 255) | (pixel & 255) << 16;
+      }
+    }
+
+    // Premultiplied ARGB32 to opaque RGB565, which is the pixel composited
+    // over black.
+    static void argbToRGB565(const uint32_t* src, uint16_t* dst, int count)
+    {
+      for (int x = 0; x < count; x++)
+      {
+        const uint32_t pixel = src[x];
+        dst[x] = static_cast<uint16_t>((pixel >> 8 & 0xf800) | (pixel >> 5 & 0x07e0) | (pixel >> 3 & 0x001f));
+      }
+    }
+
+    // Composites premultiplied pixels source over, scaled by `alpha` (0 to
+    // 255), rounding as plutovg's compositor does.
+    static void blendSrcOver(const uint32_t* src, uint32_t* dst, int count, uint32_t alpha)
+    {
+      for (int x = 0; x < count; x++)
+      {
+        const uint32_t pixel = alpha == 255 ? src[x] : byteMul(src[x], alpha);
+        const uint32_t pixelAlpha = pixel >> 24;
+        if (pixelAlpha == 255)
+          dst[x] = pixel;
+        else if (pixelAlpha != 0)
+          dst[x] = pixel + byteMul(dst[x], 255 - pixelAlpha);
+      }
+    }
+
+    // Each channel of `x` times `a` / 255.
+    static uint32_t byteMul(uint32_t x, uint32_t a)
+    {
+      uint32_t t = (x & 0xff00ff) * a;
+      t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+      t &= 0xff00ff;
+
+      x = ((x >> 8) & 0xff00ff) * a;
+      x = x + ((x >> 8) & 0xff00ff) + 0x800080;
+      x &= 0xff00ff00;
+      return x | t;
+    }
+
+    static const size_t kStreamingThreshold = size_t(1) << 20;
+
+    static void clearStreaming(uint8_t* data, size_t size)
+    {
+      if (size < kStreamingThreshold)
+      {
+        memset(data, 0, size);
+        return;
+      }
+
+      streamZero(data, size);
+#ifdef PLUTONRIVER_SSE2
+      _mm_sfence();
+#endif
+    }
+
+    // Non-temporal stores need to be fenced before the memory is read again.
+    static void streamZero(uint8_t* data, size_t size)
+    {
+#ifdef PLUTONRIVER_SSE2
+      const size_t head = (16 - (reinterpret_cast<uintptr_t>(data) & 15)) & 15;
+      if (size < head + 16)
+      {
+        memset(data, 0, size);
+        return;
+      }
+
+      memset(data, 0, head);
+      const __m128i zero = _mm_setzero_si128();
+      size_t offset = head;
+      for (; offset + 64 <= size; offset += 64)
+      {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(data + offset), zero);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(data + offset + 16), zero);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(data + offset + 32), zero);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(data + offset + 48), zero);
+      }
+      for (; offset + 16 <= size; offset += 16)
+        _mm_stream_si128(reinterpret_cast<__m128i*>(data + offset), zero);
+      memset(data + offset, 0, size - offset);
+#else
+      memset(data, 0, size);
+#endif
+    }
+
+    static void rgb565ToARGB(const uint16_t* src, uint32_t* dst, int count)
+    {
+      for (int x = 0; x < count; x++)
+      {
+        const uint32_t r = src[x] >> 11 & 31, g = src[x] >> 5 & 63, b = src[x] & 31;
+        dst[x] = 0xff000000 | (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2);
+      }
+    }
+  };
+} // namespace rive
+
+#endif
@@ -21,32 +21,174 @@
 #include <plutonriver/renderer.hpp>
 #include <plutonriver/to_plutovg.hpp>
 
+#include <coverage_rasterizer.hpp>
+#include <path_ops.hpp>
+#include <pixel_ops.hpp>
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_NO_STDIO
 #include <stb_image.h>
 
 #include <stb_image_write.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+
 using namespace rive;
 
+// Source of path generations, unique across every path.
+static std::atomic<uint64_t> s_pathGenerations{0};
+
+namespace rive
+{
+  // Storage of destroyed paths: their verb and point vectors and plutovg path
+  // keep their capacity, so artboard instances made and dropped over and over
+  // stop allocating path storage once warmed up.
+  class PlutoVG_PathPool : public RefCnt<PlutoVG_PathPool>
+  {
+  public:
+    struct Storage
+    {
+      std::vector<PathVerb> verbs;
+      std::vector<Vec2D> points;
+      plutovg_path_t* path{nullptr};
+    };
+
+    ~PlutoVG_PathPool()
+    {
+      for (const Storage& storage : m_storage)
+        plutovg_path_destroy(storage.path);
+    }
+
+    // Moves pooled storage into `storage`, which is left as it is when the
+    // pool is empty.
+    void take(Storage& storage)
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_storage.empty())
+        return;
+
+      storage = std::move(m_storage.back());
+      m_storage.pop_back();
+    }
+
+    // Keeps the storage of a destroyed path, or frees it when the pool is
+    // full or the storage grew past what paths commonly need, so that one
+    // huge path does not stay pinned. The vectors are cleared.
+    void give(Storage&& storage)
+    {
+      if (storage.points.capacity() <= kMaxPooledPoints)
+      {
+        storage.verbs.clear();
+        storage.points.clear();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_storage.size() < kMaxPooledPaths)
+        {
+          m_storage.push_back(std::move(storage));
+          return;
+        }
+      }
+
+      if (storage.path != nullptr)
+        plutovg_path_destroy(storage.path);
+    }
+
+  private:
+    static const size_t kMaxPooledPaths = 1024;
+    // The plutovg path holds about as many points as the vectors.
+    static const size_t kMaxPooledPoints = 4096;
+
+    std::mutex m_mutex;
+    std::vector<Storage> m_storage;
+  };
+} // namespace rive
+
+// Paths are built as rive verbs and points, which sub-paths composed into a
+// shape's path never leave: only the paths drawn or clipped with are turned
+// into plutovg paths.
 class PlutoVG_RenderPath : public RenderPath
 {
 public:
-  PlutoVG_RenderPath()
-    : m_path(plutovg_path_create())
+  PlutoVG_RenderPath() {}
+  // Takes its storage from `pool` and gives it back when destroyed.
+  explicit PlutoVG_RenderPath(rcp<PlutoVG_PathPool> pool)
+    : m_pool(std::move(pool))
+  {
+    PlutoVG_PathPool::Storage storage;
+    m_pool->take(storage);
+    m_verbs = std::move(storage.verbs);
+    m_points = std::move(storage.points);
+    m_path = storage.path;
+  }
+  PlutoVG_RenderPath(rcp<PlutoVG_PathPool> pool, Span<const PathVerb> verbs, Span<const Vec2D> points, FillRule fillRule)
+    : PlutoVG_RenderPath(std::move(pool))
+  {
+    m_fillRule = ToPlutoVG::convert(fillRule);
+    append(verbs, points);
+  }
+
+  // The plutovg path has a single owner: paths move, they do not copy.
+  PlutoVG_RenderPath(const PlutoVG_RenderPath&) = delete;
+  PlutoVG_RenderPath& operator=(const PlutoVG_RenderPath&) = delete;
+  PlutoVG_RenderPath(PlutoVG_RenderPath&& other) noexcept
   {
+    *this = std::move(other);
   }
-  PlutoVG_RenderPath(plutovg_path_t* path)
-    : m_path(path)
+  PlutoVG_RenderPath& operator=(PlutoVG_RenderPath&& other) noexcept
   {
+    std::swap(m_verbs, other.m_verbs);
+    std::swap(m_points, other.m_points);
+    std::swap(m_path, other.m_path);
+    std::swap(m_pathVerbs, other.m_pathVerbs);
+    std::swap(m_pathPoints, other.m_pathPoints);
+    std::swap(m_fillRule, other.m_fillRule);
+    std::swap(m_generation, other.m_generation);
+    std::swap(m_minX, other.m_minX);
+    std::swap(m_minY, other.m_minY);
+    std::swap(m_maxX, other.m_maxX);
+    std::swap(m_maxY, other.m_maxY);
+    std::swap(m_pool, other.m_pool);
+    std::swap(m_rebuilding, other.m_rebuilding);
+    std::swap(m_verbCursor, other.m_verbCursor);
+    std::swap(m_pointCursor, other.m_pointCursor);
+    return *this;
   }
 
   ~PlutoVG_RenderPath() override
   {
-    plutovg_path_destroy(m_path);
+    if (m_pool != nullptr)
+      m_pool->give({std::move(m_verbs), std::move(m_points), m_path});
+    else if (m_path != nullptr)
+      plutovg_path_destroy(m_path);
   }
 
-  const plutovg_path_t* path() const { return m_path; }
+  // The path as plutovg draws it, rebuilt after changes.
+  const plutovg_path_t* path() const;
+
+  // Identifies the points and verbs of the path, which get a new generation
+  // whenever they change, so clips made from it can be found again. Rebuilding
+  // the same contents keeps the generation.
+  uint64_t generation() const
+  {
+    settle();
+    if (m_generation == 0)
+      m_generation = ++s_pathGenerations;
+    return m_generation;
+  }
+
+  // Bounds of every point added, control points included, which contain the
+  // curves. Kept up to date as the path is built.
+  bool hasBounds() const
+  {
+    settle();
+    return m_minX <= m_maxX;
+  }
 
   void reset() override;
   void addRenderPath(RenderPath* path, const Mat2D& transform) override;
@@ -56,11 +198,61 @@ public:
   void cubicTo(float ox, float oy, float ix, float iy, float x, float y) override;
   void close() override;
 
+  // Makes room for that many more verbs and points.
+  void reserve(size_t verbCount, size_t pointCount);
+  // Appends whole verbs and the points they use, in one go.
+  void append(Span<const PathVerb> verbs, Span<const Vec2D> points);
+
+  // Ends a rebuild started by reset(). Rive gives no signal when a path is
+  // built, so this runs as the path is first used: contents that turned out
+  // shorter than the old ones are cut there.
+  void settle() const
+  {
+    if (m_rebuilding)
+      const_cast<PlutoVG_RenderPath*>(this)->endRebuild();
+  }
+
 private:
   friend class rive::PlutoVG_Renderer;
+  friend class rive::PlutoVG_HashRenderer;
+
+  void expand(float x, float y)
+  {
+    m_minX = std::min(m_minX, x);
+    m_minY = std::min(m_minY, y);
+    m_maxX = std::max(m_maxX, x);
+    m_maxY = std::max(m_maxY, y);
+  }
+
+  void changed()
+  {
+    m_generation = 0;
+  }
 
-  plutovg_path_t* m_path{nullptr};
+  void write(const PathVerb* verbs, size_t verbCount, const Vec2D* points, size_t pointCount);
+  void diverge();
+  void endRebuild();
+
+  std::vector<PathVerb> m_verbs;
+  std::vector<Vec2D> m_points;
+  mutable plutovg_path_t* m_path{nullptr};
+  // The verbs and points m_path was built from, a prefix of the contents:
+  // only what was added past them is replayed. See path().
+  mutable size_t m_pathVerbs{0};
+  mutable size_t m_pathPoints{0};
   plutovg_fill_rule_t m_fillRule{plutovg_fill_rule_non_zero};
+  // Assigned on first use after a change, see generation().
+  mutable uint64_t m_generation{0};
+  float m_minX{std::numeric_limits<float>::max()};
+  float m_minY{std::numeric_limits<float>::max()};
+  float m_maxX{-std::numeric_limits<float>::max()};
+  float m_maxY{-std::numeric_limits<float>::max()};
+  rcp<PlutoVG_PathPool> m_pool;
+  // After reset(), the old contents are kept and compared with what is added
+  // up to the cursors, until they differ. See write().
+  bool m_rebuilding{false};
+  size_t m_verbCursor{0};
+  size_t m_pointCursor{0};
 };
 
 class PlutoVG_RenderPaint : public RenderPaint
@@ -78,6 +270,7 @@ public:
 
 private:
   friend class rive::PlutoVG_Renderer;
+  friend class rive::PlutoVG_HashRenderer;
 
   RenderPaintStyle m_style{RenderPaintStyle::fill};
   unsigned int m_color{0};
@@ -96,52 +289,260 @@ public:
 
   ~PlutoVG_RenderImage() override
   {
+    for (const ThreadTexture& threadTexture : m_threadTextures)
+      plutovg_texture_destroy(threadTexture.texture);
     plutovg_texture_destroy(m_texture);
 
     free(plutovg_surface_get_data(m_surface));
     plutovg_surface_destroy(m_surface);
+
+    if (m_swappedTexture != nullptr)
+    {
+      plutovg_surface_t* swappedSurface = plutovg_texture_get_surface(m_swappedTexture);
+      free(plutovg_surface_get_data(swappedSurface));
+      plutovg_texture_destroy(m_swappedTexture);
+    }
   }
 
   const plutovg_texture_t* texture() const { return m_texture; }
 
+  // The image with red and blue swapped, for rgba8888 targets. Built on first
+  // use, images are shared by every artboard instance of a file.
+  plutovg_texture_t* swappedTexture() const;
+
+  // The texture the calling thread draws the image with, swapped or not.
+  // Contexts reference the texture they draw with, and plutovg counts
+  // references with plain integers: threads drawing the same image each get
+  // a texture of their own over its pixels.
+  plutovg_texture_t* threadTexture(bool swapRedBlue) const;
+
 private:
   friend class rive::PlutoVG_Renderer;
+  friend class rive::PlutoVG_HashRenderer;
 
   plutovg_texture_t* m_texture{nullptr};
   plutovg_surface_t* m_surface{nullptr};
+
+  mutable std::once_flag m_swappedOnce;
+  mutable plutovg_texture_t* m_swappedTexture{nullptr};
+
+  struct ThreadTexture
+  {
+    std::thread::id thread;
+    bool swapped;
+    plutovg_texture_t* texture;
+  };
+  mutable std::mutex m_threadTexturesMutex;
+  mutable std::vector<ThreadTexture> m_threadTextures;
 };
 
 class PlutoVG_RenderShader : public RenderShader
 {
 public:
   PlutoVG_RenderShader() {}
-  PlutoVG_RenderShader(plutovg_gradient_t* gradient)
-    : m_gradient(gradient)
+  // `params` are the linear gradient's start and end points, or the radial
+  // gradient's center and radius.
+  PlutoVG_RenderShader(bool radial, const float params[4], std::vector<plutovg_gradient_stop_t> stops, uint64_t hash)
+    : m_radial(radial)
+    , m_params{params[0], params[1], params[2], params[3]}
+    , m_stops(std::move(stops))
+    , m_hash(hash)
   {
+    m_gradient = createGradient(false);
   }
 
   ~PlutoVG_RenderShader() override
   {
     plutovg_gradient_destroy(m_gradient);
+    if (m_swappedGradient != nullptr)
+      plutovg_gradient_destroy(m_swappedGradient);
   }
 
   const plutovg_gradient_t* gradient() const { return m_gradient; }
 
+  // The same gradient with red and blue swapped, for rgba8888 targets. Built
+  // on first use, the other targets never need it.
+  plutovg_gradient_t* swappedGradient() const;
+
 private:
   friend class rive::PlutoVG_Renderer;
+  friend class rive::PlutoVG_HashRenderer;
+
+  plutovg_gradient_t* createGradient(bool swapRedBlue) const;
 
   plutovg_gradient_t* m_gradient{nullptr};
+  bool m_radial{false};
+  float m_params[4]{};
+  std::vector<plutovg_gradient_stop_t> m_stops;
+  // Identifies the gradient parameters, shader pointers may be recycled.
+  uint64_t m_hash{0};
+
+  mutable std::once_flag m_swappedOnce;
+  mutable plutovg_gradient_t* m_swappedGradient{nullptr};
 };
 
+static uint64_t hashMix(uint64_t hash, uint64_t value)
+{
+  value *= 0x9e3779b97f4a7c15ull;
+  value ^= value >> 32;
+  return (hash ^ value) * 0xff51afd7ed558ccdull;
+}
+
+static uint64_t hashMix(uint64_t hash, float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return hashMix(hash, static_cast<uint64_t>(bits));
+}
+
+static uint64_t hashGradient(uint64_t kind, const float* params, size_t paramCount, const ColorInt colors[], const float stops[], size_t count)
+{
+  uint64_t hash = hashMix(0, kind);
+  for (size_t i = 0; i < paramCount; ++i)
+    hash = hashMix(hash, params[i]);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    hash = hashMix(hash, static_cast<uint64_t>(colors[i]));
+    hash = hashMix(hash, stops[i]);
+  }
+
+  return hash;
+}
+
+// The contents are kept twice for paths drawn or clipped with: as verbs and
+// points, which rebuilds are compared against, and as the plutovg path. Only
+// the verbs added since the last use are replayed into the plutovg path, but
+// plutovg paths cannot be cut: a rebuild diverging within the part already
+// replayed replays the whole path again.
+const plutovg_path_t* PlutoVG_RenderPath::path() const
+{
+  if (m_path == nullptr)
+    m_path = plutovg_path_create();
+
+  settle();
+  if (m_pathVerbs == 0)
+    plutovg_path_clear(m_path);
+  if (m_pathVerbs < m_verbs.size())
+  {
+    ToPlutoVG::append(m_path, Span<const PathVerb>(m_verbs.data() + m_pathVerbs, m_verbs.size() - m_pathVerbs), Span<const Vec2D>(m_points.data() + m_pathPoints, m_points.size() - m_pathPoints));
+    m_pathVerbs = m_verbs.size();
+    m_pathPoints = m_points.size();
+  }
+
+  return m_path;
+}
+
 void PlutoVG_RenderPath::reset()
 {
-  plutovg_path_clear(m_path);
+  // Rive rebuilds every path of a dirty shape, moved or not: the contents
+  // are only dropped once the new ones differ.
+  m_rebuilding = true;
+  m_verbCursor = 0;
+  m_pointCursor = 0;
+}
+
+// Appends verbs and the points they use. While rebuilding, verbs and points
+// equal to the old contents are stepped over instead.
+void PlutoVG_RenderPath::write(const PathVerb* verbs, size_t verbCount, const Vec2D* points, size_t pointCount)
+{
+  if (verbCount == 0)
+    return;
+
+  if (m_rebuilding)
+  {
+    if (m_verbCursor + verbCount <= m_verbs.size() && m_pointCursor + pointCount <= m_points.size() &&
+        memcmp(m_verbs.data() + m_verbCursor, verbs, verbCount * sizeof(PathVerb)) == 0 &&
+        (pointCount == 0 || memcmp(m_points.data() + m_pointCursor, points, pointCount * sizeof(Vec2D)) == 0))
+    {
+      m_verbCursor += verbCount;
+      m_pointCursor += pointCount;
+      return;
+    }
+
+    diverge();
+  }
+
+  m_verbs.insert(m_verbs.end(), verbs, verbs + verbCount);
+  m_points.insert(m_points.end(), points, points + pointCount);
+  changed();
+}
+
+// Drops the old contents past the part rebuilt so far.
+void PlutoVG_RenderPath::diverge()
+{
+  m_rebuilding = false;
+  m_verbs.resize(m_verbCursor);
+  m_points.resize(m_pointCursor);
+  changed();
+  if (m_verbCursor < m_pathVerbs)
+    m_pathVerbs = m_pathPoints = 0;
+
+  m_minX = m_minY = std::numeric_limits<float>::max();
+  m_maxX = m_maxY = -std::numeric_limits<float>::max();
+  for (const Vec2D& point : m_points)
+    expand(point.x, point.y);
+}
+
+void PlutoVG_RenderPath::endRebuild()
+{
+  if (m_verbCursor == m_verbs.size() && m_pointCursor == m_points.size())
+    m_rebuilding = false;
+  else
+    diverge();
+}
+
+void PlutoVG_RenderPath::reserve(size_t verbCount, size_t pointCount)
+{
+  m_verbs.reserve(m_verbs.size() + verbCount);
+  m_points.reserve(m_points.size() + pointCount);
+}
+
+void PlutoVG_RenderPath::append(Span<const PathVerb> verbs, Span<const Vec2D> points)
+{
+  if (verbs.empty())
+    return;
+
+  write(verbs.data(), verbs.size(), points.data(), points.size());
+  for (const Vec2D& point : points)
+    expand(point.x, point.y);
 }
 
 void PlutoVG_RenderPath::addRenderPath(RenderPath* path, const Mat2D& transform)
 {
-  const auto& matrix = ToPlutoVG::convert(transform);
-  plutovg_path_add_path(m_path, reinterpret_cast<PlutoVG_RenderPath*>(path)->m_path, &matrix);
+  const auto* pathData = reinterpret_cast<PlutoVG_RenderPath*>(path);
+  pathData->settle();
+  const size_t count = pathData->m_points.size();
+  if (m_rebuilding)
+  {
+    // Compared with the old contents once transformed.
+    static thread_local std::vector<Vec2D> transformed;
+    transformed.resize(count);
+    PathOps::transform(pathData->m_points.data(), transformed.data(), count, transform, PathOps::classify(transform));
+    write(pathData->m_verbs.data(), pathData->m_verbs.size(), transformed.data(), count);
+  }
+  else
+  {
+    const size_t first = m_points.size();
+    reserve(pathData->m_verbs.size(), count);
+    m_verbs.insert(m_verbs.end(), pathData->m_verbs.begin(), pathData->m_verbs.end());
+    m_points.resize(first + count);
+    PathOps::transform(pathData->m_points.data(), m_points.data() + first, count, transform, PathOps::classify(transform));
+    changed();
+  }
+
+  // The transformed corners of the added path's bounds contain its points.
+  if (pathData->hasBounds())
+  {
+    for (const Vec2D corner : {Vec2D(pathData->m_minX, pathData->m_minY),
+           Vec2D(pathData->m_maxX, pathData->m_minY),
+           Vec2D(pathData->m_maxX, pathData->m_maxY),
+           Vec2D(pathData->m_minX, pathData->m_maxY)})
+    {
+      const Vec2D point = transform * corner;
+      expand(point.x, point.y);
+    }
+  }
 }
 
 void PlutoVG_RenderPath::fillRule(FillRule fill)
@@ -151,22 +552,34 @@ void PlutoVG_RenderPath::fillRule(FillRule fill)
 
 void PlutoVG_RenderPath::moveTo(float x, float y)
 {
-  plutovg_path_move_to(m_path, x, y);
+  const PathVerb verb = PathVerb::move;
+  const Vec2D point(x, y);
+  write(&verb, 1, &point, 1);
+  expand(x, y);
 }
 
 void PlutoVG_RenderPath::lineTo(float x, float y)
 {
-  plutovg_path_line_to(m_path, x, y);
+  const PathVerb verb = PathVerb::line;
+  const Vec2D point(x, y);
+  write(&verb, 1, &point, 1);
+  expand(x, y);
 }
 
 void PlutoVG_RenderPath::cubicTo(float ox, float oy, float ix, float iy, float x, float y)
 {
-  plutovg_path_cubic_to(m_path, ox, oy, ix, iy, x, y);
+  const PathVerb verb = PathVerb::cubic;
+  const Vec2D points[] = {Vec2D(ox, oy), Vec2D(ix, iy), Vec2D(x, y)};
+  write(&verb, 1, points, 3);
+  expand(ox, oy);
+  expand(ix, iy);
+  expand(x, y);
 }
 
 void PlutoVG_RenderPath::close()
 {
-  plutovg_path_close(m_path);
+  const PathVerb verb = PathVerb::close;
+  write(&verb, 1, nullptr, 0);
 }
 
 void PlutoVG_RenderPaint::style(RenderPaintStyle style)
@@ -220,207 +633,1573 @@ PlutoVG_RenderImage::PlutoVG_RenderImage(plutovg_texture_t* texture)
   m_Height = plutovg_surface_get_height(m_surface);
 }
 
-PlutoVG_Renderer::~PlutoVG_Renderer()
+plutovg_gradient_t* PlutoVG_RenderShader::createGradient(bool swapRedBlue) const
 {
-  plutovg_destroy(m_context);
-  plutovg_surface_destroy(m_surface);
+  plutovg_gradient_t* gradient = m_radial ? plutovg_gradient_create_radial(m_params[0], m_params[1], m_params[2], m_params[0], m_params[1], 0)
+                                          : plutovg_gradient_create_linear(m_params[0], m_params[1], m_params[2], m_params[3]);
+  for (plutovg_gradient_stop_t stop : m_stops)
+  {
+    if (swapRedBlue)
+      std::swap(stop.color.r, stop.color.b);
+    plutovg_gradient_add_stop(gradient, &stop);
+  }
+
+  return gradient;
 }
 
-void PlutoVG_Renderer::save()
+plutovg_gradient_t* PlutoVG_RenderShader::swappedGradient() const
 {
-  if (m_context == nullptr)
-    return;
-
-  plutovg_save(m_context);
+  std::call_once(m_swappedOnce, [this]() { m_swappedGradient = createGradient(true); });
+  return m_swappedGradient;
 }
 
-void PlutoVG_Renderer::restore()
+plutovg_texture_t* PlutoVG_RenderImage::swappedTexture() const
 {
-  if (m_context == nullptr)
-    return;
+  std::call_once(m_swappedOnce,
+    [this]()
+    {
+      const int stride = plutovg_surface_get_stride(m_surface);
+      const uint8_t* data = plutovg_surface_get_data(m_surface);
+      auto* image = static_cast<uint8_t*>(malloc(static_cast<size_t>(stride) * m_Height));
 
-  plutovg_restore(m_context);
-}
+      for (int y = 0; y < m_Height; y++)
+        PixelOps::swapRedBlue(reinterpret_cast<const uint32_t*>(data + stride * y), reinterpret_cast<uint32_t*>(image + stride * y), m_Width);
 
-void PlutoVG_Renderer::transform(const Mat2D& transform)
-{
-  if (m_context == nullptr)
-    return;
+      plutovg_surface_t* surface = plutovg_surface_create_for_data(image, m_Width, m_Height, stride);
+      m_swappedTexture = plutovg_texture_create(surface);
+      plutovg_surface_destroy(surface);
+    });
 
-  const auto& matrix = ToPlutoVG::convert(transform);
-  plutovg_transform(m_context, &matrix);
+  return m_swappedTexture;
 }
 
-void PlutoVG_Renderer::clipPath(RenderPath* path)
+plutovg_texture_t* PlutoVG_RenderImage::threadTexture(bool swapRedBlue) const
 {
-  if (m_context == nullptr)
-    return;
+  const std::thread::id thread = std::this_thread::get_id();
+  plutovg_surface_t* surface = plutovg_texture_get_surface(swapRedBlue ? swappedTexture() : m_texture);
+
+  // Textures are only made and destroyed under the lock or with the image,
+  // which keeps the count of the shared surface consistent.
+  std::lock_guard<std::mutex> lock(m_threadTexturesMutex);
+  for (const ThreadTexture& threadTexture : m_threadTextures)
+  {
+    if (threadTexture.thread == thread && threadTexture.swapped == swapRedBlue)
+      return threadTexture.texture;
+  }
 
-  plutovg_add_path(m_context, reinterpret_cast<PlutoVG_RenderPath*>(path)->path());
-  plutovg_clip(m_context);
+  plutovg_texture_t* texture = plutovg_texture_create(surface);
+  m_threadTextures.push_back({thread, swapRedBlue, texture});
+  return texture;
 }
 
-void PlutoVG_Renderer::drawPath(RenderPath* path, RenderPaint* paint)
+// Bounds how far miter joins reach, in half stroke widths. The renderer never
+// sets a miter limit, so this is a deliberately conservative bound on
+// plutovg's default rather than its exact value: overestimating only pads the
+// bounds a stroke is culled and pre-clipped with. a8 strokes miter up to it.
+static const float kMiterLimit = 10.0f;
+// Bounds each batched fill is checked against, which keeps the checks cheap.
+static const size_t kMaxBatchSize = 64;
+// Frames a clip level is kept for without being used.
+static const uint64_t kClipLevelFrames = 4;
+
+static bool usesWorkingSurface(PlutoVG_PixelFormat format)
 {
-  if (m_context == nullptr)
-    return;
+  return format == PlutoVG_PixelFormat::rgb565;
+}
 
-  const auto* pathData = reinterpret_cast<PlutoVG_RenderPath*>(path);
-  const auto* paintData = reinterpret_cast<PlutoVG_RenderPaint*>(paint);
+PlutoVG_Renderer::PlutoVG_Renderer(uint8_t* data, int width, int height, int stride, PlutoVG_PixelFormat format)
+  : m_context(nullptr)
+  , m_surface(nullptr)
+{
+  attach(data, width, height, stride, format);
+}
 
-  plutovg_add_path(m_context, pathData->path());
+PlutoVG_Renderer::~PlutoVG_Renderer()
+{
+  detach();
+  if (m_batchPath != nullptr)
+    plutovg_path_destroy(m_batchPath);
+  if (m_preClipPath != nullptr)
+    plutovg_path_destroy(m_preClipPath);
+}
 
-  if (paintData->m_shader != nullptr)
+// The device rectangle covered by a path made of a single rectangle whose
+// edges fall on pixel boundaries once transformed, whose coverage is exactly
+// the pixels inside it.
+static bool pixelRect(const plutovg_path_t* path, const Mat2D& matrix, PlutoVG_IRect& rect)
+{
+  const int elementCount = plutovg_path_get_element_count(path);
+  const plutovg_path_element_t* elements = plutovg_path_get_elements(path);
+  if (elementCount < 4 || elementCount > 6 || elements[0] != plutovg_path_element_move_to)
+    return false;
+
+  int pointCount = elementCount;
+  if (elements[elementCount - 1] == plutovg_path_element_close)
+    pointCount--;
+  for (int i = 1; i < pointCount; i++)
   {
-    const auto* shaderData = reinterpret_cast<PlutoVG_RenderShader*>(paintData->m_shader.get());
-    plutovg_set_source_gradient(m_context, shaderData->m_gradient);
+    if (elements[i] != plutovg_path_element_line_to)
+      return false;
   }
-  else
+  if (pointCount < 4)
+    return false;
+
+  const plutovg_point_t* points = plutovg_path_get_points(path);
+  Vec2D corners[5];
+  for (int i = 0; i < pointCount; i++)
+    corners[i] = matrix * Vec2D(static_cast<float>(points[i].x), static_cast<float>(points[i].y));
+
+  constexpr float kTolerance = 1.0f / 256.0f;
+  auto same = [](float a, float b) { return std::abs(a - b) < kTolerance; };
+  if (pointCount == 5 && !(same(corners[4].x, corners[0].x) && same(corners[4].y, corners[0].y)))
+    return false;
+
+  // Edges alternate between horizontal and vertical around the four corners.
+  const bool horizontalFirst = same(corners[0].y, corners[1].y);
+  for (int i = 0; i < 4; i++)
   {
-    const plutovg_color_t& color = ToPlutoVG::convert(paintData->m_color);
-    plutovg_set_source_color(m_context, &color);
+    const Vec2D& from = corners[i];
+    const Vec2D& to = corners[(i + 1) % 4];
+    const bool horizontal = (i % 2 == 0) == horizontalFirst;
+    if (horizontal ? !same(from.y, to.y) : !same(from.x, to.x))
+      return false;
   }
 
-  switch (paintData->m_style)
+  const float left = std::min(corners[0].x, corners[2].x);
+  const float top = std::min(corners[0].y, corners[2].y);
+  const float right = std::max(corners[0].x, corners[2].x);
+  const float bottom = std::max(corners[0].y, corners[2].y);
+  for (const float edge : {left, top, right, bottom})
   {
-    case RenderPaintStyle::fill:
-      plutovg_set_fill_rule(m_context, pathData->m_fillRule);
-      plutovg_fill(m_context);
-      break;
-
-    case RenderPaintStyle::stroke:
-      plutovg_set_line_width(m_context, paintData->m_thickness);
-      plutovg_set_line_cap(m_context, ToPlutoVG::convert(paintData->m_cap));
-      plutovg_set_line_join(m_context, ToPlutoVG::convert(paintData->m_join));
-      plutovg_stroke(m_context);
-      break;
+    if (!same(edge, std::round(edge)))
+      return false;
   }
+
+  const int x = static_cast<int>(std::round(left));
+  const int y = static_cast<int>(std::round(top));
+  rect = {x, y, static_cast<int>(std::round(right)) - x, static_cast<int>(std::round(bottom)) - y};
+  return true;
 }
 
-void PlutoVG_Renderer::drawImage(const RenderImage* image, BlendMode blendMode, float opacity)
+void PlutoVG_Renderer::attach(uint8_t* data, int width, int height, int stride, PlutoVG_PixelFormat format)
 {
-  if (m_context == nullptr)
+  m_format = format;
+  if (format == PlutoVG_PixelFormat::a8)
+  {
+    m_target = data;
+    m_targetStride = stride;
+    m_targetWidth = width;
+    m_targetHeight = height;
+    m_coverage = new CoverageRasterizer();
     return;
+  }
+  if (usesWorkingSurface(format))
+  {
+    m_target = data;
+    m_targetStride = stride;
+    m_targetWidth = width;
+    m_targetHeight = height;
+    m_surface = plutovg_surface_create(width, height);
+    loadTarget();
+  }
+  else
+  {
+    m_surface = plutovg_surface_create_for_data(data, width, height, stride);
+  }
 
-  const auto* imageData = reinterpret_cast<const PlutoVG_RenderImage*>(image);
-
-  plutovg_rect(m_context, 0, 0, imageData->m_Width, imageData->m_Height);
-  plutovg_set_source_texture(m_context, imageData->m_texture);
-  plutovg_set_opacity(m_context, opacity);
-  plutovg_set_operator(m_context, ToPlutoVG::convert(blendMode));
-  plutovg_fill(m_context);
+  m_context = plutovg_create(m_surface);
 }
 
-void PlutoVG_Renderer::drawImageMesh(const RenderImage* image,
-  rcp<RenderBuffer> vertices,
-  rcp<RenderBuffer> uvCoords,
-  rcp<RenderBuffer> indices,
-  BlendMode blendMode,
-  float opacity)
+void PlutoVG_Renderer::detach()
 {
-  // if (m_context == nullptr)
-  //   return;
-
-  // // need our vertices and uvs to agree
-  // assert(vertices->count() == uvCoords->count());
-  // // vertices and uvs are arrays of floats, so we need their counts to be
-  // // even, since we treat them as arrays of points
-  // assert((vertices->count() & 1) == 0);
-
-  // // const int vertexCount = vertices->count() >> 1;
-
-  // plutovg_matrix_t matrix;
-  // plutovg_matrix_init_identity(&matrix);
-
-  // // auto uvs = (const plutovg_point_t *)DataRenderBuffer::Cast(uvCoords.get())->vecs();
-
-  // const auto* imageData = reinterpret_cast<const PlutoVG_RenderImage*>(image);
-
-  // plutovg_set_source_texture(m_context, imageData->m_texture);
-  // plutovg_set_opacity(m_context, opacity);
-  // plutovg_set_operator(m_context, ToPlutoVG::convert(blendMode));
-  // plutovg_set_matrix(m_context, &matrix);
-  // plutovg_paint(m_context);
+  // The surface may outlive the renderer: pending fills are drawn into it.
+  flushBatch();
+  releaseScissor();
+  m_state = State();
+  m_stateStack.clear();
+  m_saveCount = 0;
+  m_clipLevels.clear();
+  if (m_context != nullptr)
+  {
+    plutovg_destroy(m_context);
+    plutovg_surface_destroy(m_surface);
+  }
+  delete m_coverage;
+  m_coverage = nullptr;
+  m_context = nullptr;
+  m_contextState = ContextState();
+  m_drawContext = nullptr;
+  m_drawState = nullptr;
+  m_surface = nullptr;
+  m_target = nullptr;
+  m_targetStride = 0;
+  m_targetWidth = 0;
+  m_targetHeight = 0;
+  m_damage = {};
 }
 
-int PlutoVG_Renderer::width() const
+// The buffer is loaded into the working surface so that frames are drawn over
+// its current content.
+void PlutoVG_Renderer::loadTarget()
 {
-  if (m_surface == nullptr)
-    return 0;
-
-  return plutovg_surface_get_width(m_surface);
+  uint8_t* surfaceData = plutovg_surface_get_data(m_surface);
+  const int surfaceStride = plutovg_surface_get_stride(m_surface);
+  const int width = plutovg_surface_get_width(m_surface);
+  const int height = plutovg_surface_get_height(m_surface);
+  for (int y = 0; y < height; y++)
+  {
+    const uint8_t* src = m_target + static_cast<size_t>(m_targetStride) * y;
+    auto* dst = reinterpret_cast<uint32_t*>(surfaceData + static_cast<size_t>(surfaceStride) * y);
+    PixelOps::rgb565ToARGB(reinterpret_cast<const uint16_t*>(src), dst, width);
+  }
 }
 
-int PlutoVG_Renderer::height() const
+void PlutoVG_Renderer::resetState()
 {
-  if (m_surface == nullptr)
-    return 0;
-
-  return plutovg_surface_get_height(m_surface);
+  m_state = State();
+  m_stateStack.clear();
+  m_saveCount = 0;
+  m_damage = {};
+
+  // Contexts keep their state, but colors are issued swapped for rgba8888
+  // targets and the format may have changed.
+  m_contextState.source = ContextState::Source::unknown;
+  m_scissorState.source = ContextState::Source::unknown;
+  for (const rcp<ClipLevel>& level : m_clipLevels)
+    level->state.source = ContextState::Source::unknown;
 }
 
-int PlutoVG_Renderer::stride() const
+void PlutoVG_Renderer::reset(plutovg_surface_t* surface)
 {
-  if (m_surface == nullptr)
-    return 0;
+  // Pending fills belong to the previous target, which keeps its pixels.
+  flushBatch();
+  endFrame();
+  if (surface == m_surface && m_target == nullptr)
+  {
+    m_format = PlutoVG_PixelFormat::argb32Premultiplied;
+    resetState();
+    return;
+  }
 
-  return plutovg_surface_get_stride(m_surface);
+  detach();
+  m_format = PlutoVG_PixelFormat::argb32Premultiplied;
+  m_surface = plutovg_surface_reference(surface);
+  m_context = plutovg_create(surface);
 }
 
-uint8_t* PlutoVG_Renderer::data() const
+void PlutoVG_Renderer::reset(uint8_t* data, int width, int height, int stride, PlutoVG_PixelFormat format)
 {
-  if (m_surface == nullptr)
-    return nullptr;
+  // Pending fills belong to the previous target, which keeps its pixels.
+  flushBatch();
+  endFrame();
+  const bool sameSize = attached() && width == this->width() && height == this->height();
+  if (sameSize && format == PlutoVG_PixelFormat::a8 && m_coverage != nullptr)
+  {
+    m_target = data;
+    m_targetStride = stride;
+    resetState();
+    return;
+  }
+  if (sameSize && usesWorkingSurface(format) && usesWorkingSurface(m_format))
+  {
+    m_format = format;
+    m_target = data;
+    m_targetStride = stride;
+    loadTarget();
+    resetState();
+    return;
+  }
+  if (sameSize && !usesWorkingSurface(format) && format != PlutoVG_PixelFormat::a8 && m_target == nullptr && data == plutovg_surface_get_data(m_surface) && stride == this->stride())
+  {
+    m_format = format;
+    resetState();
+    return;
+  }
 
-  return plutovg_surface_get_data(m_surface);
+  detach();
+  attach(data, width, height, stride, format);
 }
 
-void PlutoVG_Renderer::writePNG(const char* filename) const
+// Rive saves around every drawable, and many of them change nothing before
+// restoring: saves are counted, and the state is only copied once changed.
+void PlutoVG_Renderer::save()
 {
-  if (m_surface == nullptr)
+  if (!attached())
     return;
 
-  const uint8_t* data = this->data();
-  const int width = this->width();
-  const int height = this->height();
-  const int stride = this->stride();
+  m_state.deferredSaves++;
+  m_saveCount++;
+}
 
-  auto* image = static_cast<uint8_t*>(calloc(1, static_cast<size_t>(stride) * height));
+void PlutoVG_Renderer::restore()
+{
+  if (!attached() || m_saveCount == 0)
+    return;
 
-  for (int y = 0; y < height; y++)
+  m_saveCount--;
+  if (m_state.deferredSaves > 0)
   {
-    const auto* src = reinterpret_cast<const uint32_t*>(data + stride * y);
-    auto* dst = reinterpret_cast<uint32_t*>(image + stride * y);
-    for (int x = 0; x < width; x++)
-    {
-      const uint32_t a = src[x] >> 24;
-      const uint32_t r = src[x] >> 16 & 255;
-      const uint32_t g = src[x] >> 8 & 255;
-      const uint32_t b = src[x] >> 0 & 255;
+    m_state.deferredSaves--;
+  }
+  else
+  {
+    // Batched fills are drawn under the clip they were made with.
+    if (m_stateStack.back().clip.get() != m_state.clip.get())
+      flushBatch();
 
-      dst[x] = (a << 24) | (b << 16) | (g << 8) | r;
-    }
+    m_state = std::move(m_stateStack.back());
+    m_stateStack.pop_back();
   }
 
-  stbi_write_png(filename, width, height, 4, image, stride);
-  free(image);
+  // Leaving the outermost save ends a frame, which is when callers read the
+  // pixels.
+  if (m_saveCount == 0)
+  {
+    flushBatch();
+    endFrame();
+  }
 }
 
-rcp<RenderBuffer> PlutonRiver_Factory::makeBufferU16(Span<const uint16_t> data)
+// Called before the state changes, to keep a copy for the pending save.
+void PlutoVG_Renderer::materializeSave()
 {
-  return DataRenderBuffer::Make(data);
+  if (m_state.deferredSaves == 0)
+    return;
+
+  m_state.deferredSaves--;
+  m_stateStack.push_back(m_state);
+  m_state.deferredSaves = 0;
 }
 
-rcp<RenderBuffer> PlutonRiver_Factory::makeBufferU32(Span<const uint32_t> data)
+void PlutoVG_Renderer::transform(const Mat2D& transform)
 {
-  return DataRenderBuffer::Make(data);
+  if (!attached() || transform == Mat2D())
+    return;
+
+  // Contexts are given the matrix when they are drawn with, see setMatrix().
+  materializeSave();
+  m_state.matrix = m_state.matrix * transform;
+  m_state.matrixType = std::max(m_state.matrixType, PathOps::classify(transform));
 }
 
-rcp<RenderBuffer> PlutonRiver_Factory::makeBufferF32(Span<const float> data)
+void PlutoVG_Renderer::setMatrix(const Mat2D& matrix)
+{
+  if (m_drawState->matrix == matrix)
+    return;
+
+  const plutovg_matrix_t value = ToPlutoVG::convert(matrix);
+  plutovg_set_matrix(m_drawContext, &value);
+  m_drawState->matrix = matrix;
+}
+
+// Sets a transform to device space, offset for contexts drawing into a view.
+void PlutoVG_Renderer::setDeviceMatrix(const Mat2D& matrix)
+{
+  if (m_drawX == 0 && m_drawY == 0)
+    setMatrix(matrix);
+  else
+    setMatrix(Mat2D(1.0f, 0.0f, 0.0f, 1.0f, static_cast<float>(-m_drawX), static_cast<float>(-m_drawY)) * matrix);
+}
+
+void PlutoVG_Renderer::setColorSource(unsigned int color)
+{
+  if (m_drawState->source == ContextState::Source::color && m_drawState->color == color)
+    return;
+
+  plutovg_color_t value = ToPlutoVG::convert(color);
+  if (m_format == PlutoVG_PixelFormat::rgba8888)
+    std::swap(value.r, value.b);
+  plutovg_set_source_color(m_drawContext, &value);
+
+  m_drawState->source = ContextState::Source::color;
+  m_drawState->color = color;
+  m_drawState->sourceObject = nullptr;
+}
+
+void PlutoVG_Renderer::setGradientSource(plutovg_gradient_t* gradient)
+{
+  if (m_drawState->source == ContextState::Source::gradient && m_drawState->sourceObject == gradient)
+    return;
+
+  plutovg_set_source_gradient(m_drawContext, gradient);
+  m_drawState->source = ContextState::Source::gradient;
+  m_drawState->sourceObject = gradient;
+}
+
+void PlutoVG_Renderer::setTextureSource(plutovg_texture_t* texture)
+{
+  if (m_drawState->source == ContextState::Source::texture && m_drawState->sourceObject == texture)
+    return;
+
+  plutovg_set_source_texture(m_drawContext, texture);
+  m_drawState->source = ContextState::Source::texture;
+  m_drawState->sourceObject = texture;
+}
+
+void PlutoVG_Renderer::setFillRule(plutovg_fill_rule_t fillRule)
+{
+  if (m_drawState->fillRule == fillRule)
+    return;
+
+  plutovg_set_fill_rule(m_drawContext, fillRule);
+  m_drawState->fillRule = fillRule;
+}
+
+void PlutoVG_Renderer::setStroke(float width, plutovg_line_cap_t cap, plutovg_line_join_t join)
+{
+  if (m_drawState->lineWidth != width)
+  {
+    plutovg_set_line_width(m_drawContext, width);
+    m_drawState->lineWidth = width;
+  }
+  if (m_drawState->lineCap != cap)
+  {
+    plutovg_set_line_cap(m_drawContext, cap);
+    m_drawState->lineCap = cap;
+  }
+  if (m_drawState->lineJoin != join)
+  {
+    plutovg_set_line_join(m_drawContext, join);
+    m_drawState->lineJoin = join;
+  }
+}
+
+void PlutoVG_Renderer::setComposite(float opacity, plutovg_operator_t op)
+{
+  if (m_drawState->opacity != opacity)
+  {
+    plutovg_set_opacity(m_drawContext, opacity);
+    m_drawState->opacity = opacity;
+  }
+  if (m_drawState->op != op)
+  {
+    plutovg_set_operator(m_drawContext, op);
+    m_drawState->op = op;
+  }
+}
+
+void PlutoVG_Renderer::clipPath(RenderPath* path)
+{
+  if (!attached())
+    return;
+
+  const auto* pathData = reinterpret_cast<PlutoVG_RenderPath*>(path);
+  materializeSave();
+
+  // An empty clip path hides everything.
+  const PlutoVG_IRect bounds = pathData->hasBounds() ? deviceBounds(pathData->m_minX, pathData->m_minY, pathData->m_maxX, pathData->m_maxY, 0.0f) : PlutoVG_IRect{};
+
+  // Rectangle clips, artboard and layout bounds mostly, become a scissor as
+  // long as there is no clip level to intersect them with. Pending fills lie
+  // within the previous clip and stay batched.
+  PlutoVG_IRect rect;
+  if (m_state.clip == nullptr && pixelRect(pathData->path(), m_state.matrix, rect))
+  {
+    rect = rect.intersected(PlutoVG_IRect{0, 0, width(), height()});
+    m_state.scissor = m_state.scissored ? m_state.scissor.intersected(rect) : rect;
+    m_state.scissored = true;
+    m_state.clipBounds = m_state.clipped ? m_state.clipBounds.intersected(rect) : rect;
+    m_state.clipped = true;
+    return;
+  }
+
+  flushBatch();
+
+  // Any other clip makes a clip level, under one made from the scissor if
+  // there is one. Levels made by the previous frames are used again.
+  if (m_state.scissored)
+  {
+    const PlutoVG_IRect& scissor = m_state.scissor;
+    rcp<ClipLevel> level = findClipLevel(0, plutovg_fill_rule_non_zero, scissor);
+    if (level == nullptr)
+    {
+      plutovg_path_t* devicePath = plutovg_path_create();
+      plutovg_path_add_rect(devicePath, scissor.x, scissor.y, scissor.width, scissor.height);
+      level = makeClipLevel(devicePath, 0, plutovg_fill_rule_non_zero, scissor, m_state.clipBounds);
+    }
+    m_state.clip = level;
+    m_state.scissored = false;
+  }
+
+  const PlutoVG_IRect clipBounds = m_state.clipped ? m_state.clipBounds.intersected(bounds) : bounds;
+  const uint64_t generation = pathData->generation();
+  rcp<ClipLevel> level = findClipLevel(generation, pathData->m_fillRule, {});
+  if (level == nullptr)
+  {
+    plutovg_path_t* devicePath = plutovg_path_create();
+    if (pathData->hasBounds())
+    {
+      const plutovg_matrix_t matrix = ToPlutoVG::convert(m_state.matrix);
+      const bool identity = m_state.matrixType == PlutoVG_MatrixType::identity;
+      plutovg_path_add_path(devicePath, preClip(pathData->path(), pathData->m_minX, pathData->m_minY, pathData->m_maxX, pathData->m_maxY, 0.0f), identity ? nullptr : &matrix);
+    }
+
+    // Only clips likely to be made again next frame get a cached level. a8
+    // renderers have no context to clip in place, their level is not cached.
+    const bool changes = (m_state.clip != nullptr && m_state.clip->owner != nullptr) || clipChanges(generation);
+    if (changes && m_coverage == nullptr)
+      level = clipInPlace(devicePath, pathData->m_fillRule, clipBounds);
+    else
+      level = makeClipLevel(devicePath, generation, pathData->m_fillRule, {}, clipBounds, !changes);
+  }
+  m_state.clip = level;
+
+  m_state.clipBounds = clipBounds;
+  m_state.clipped = true;
+}
+
+void PlutoVG_Renderer::drawPath(RenderPath* path, RenderPaint* paint)
+{
+  if (!attached())
+    return;
+
+  const auto* pathData = reinterpret_cast<PlutoVG_RenderPath*>(path);
+  const auto* paintData = reinterpret_cast<PlutoVG_RenderPaint*>(paint);
+
+  if (!pathData->hasBounds())
+    return;
+
+  // Strokes reach half their width past the path, up to the miter limit at
+  // sharp miter joins and sqrt(2) at square caps.
+  float outset = 0.0f;
+  if (paintData->m_style == RenderPaintStyle::stroke)
+  {
+    outset = paintData->m_thickness * 0.5f;
+    if (paintData->m_join == StrokeJoin::miter)
+      outset *= kMiterLimit;
+    else if (paintData->m_cap == StrokeCap::square)
+      outset *= 1.4143f;
+  }
+  // Draws missing the surface or the clip are rejected before any work.
+  const PlutoVG_IRect extent = deviceBounds(pathData->m_minX, pathData->m_minY, pathData->m_maxX, pathData->m_maxY, outset);
+  const PlutoVG_IRect bounds = visibleBounds(extent);
+  if (bounds.empty())
+    return;
+  m_damage = m_damage.united(bounds);
+  const plutovg_path_t* visiblePath = preClip(pathData->path(), pathData->m_minX, pathData->m_minY, pathData->m_maxX, pathData->m_maxY, outset);
+
+  // Coverage is rasterized straight into a8 buffers, over the visible bounds
+  // alone, which the scissor is part of.
+  if (m_coverage != nullptr)
+  {
+    const PlutoVG_IRect area = m_state.clip != nullptr ? bounds.intersected(m_state.clip->view) : bounds;
+    if (area.empty())
+      return;
+
+    m_coverage->reset(area);
+    if (paintData->m_style == RenderPaintStyle::fill)
+      m_coverage->fillPath(visiblePath, m_state.matrix);
+    else
+      m_coverage->strokePath(visiblePath, m_state.matrix, paintData->m_thickness, ToPlutoVG::convert(paintData->m_cap), ToPlutoVG::convert(paintData->m_join), kMiterLimit);
+    compositeCoverage(paintData->m_style == RenderPaintStyle::fill ? pathData->m_fillRule : plutovg_fill_rule_non_zero, area);
+    return;
+  }
+
+  const bool scissor = crossesScissor(extent);
+
+  // Solid fills are batched, see flushBatch(), unless the scissor cuts them.
+  if (paintData->m_style == RenderPaintStyle::fill && paintData->m_shader == nullptr && !scissor)
+  {
+    const unsigned int color = paintData->m_color;
+    if (!canBatch(color, pathData->m_fillRule, bounds))
+      flushBatch();
+
+    if (m_batchPath == nullptr)
+      m_batchPath = plutovg_path_create();
+    if (m_batchBounds.empty())
+    {
+      m_batchColor = color;
+      m_batchFillRule = pathData->m_fillRule;
+    }
+
+    const plutovg_matrix_t matrix = ToPlutoVG::convert(m_state.matrix);
+    const bool identity = m_state.matrixType == PlutoVG_MatrixType::identity;
+    plutovg_path_add_path(m_batchPath, visiblePath, identity ? nullptr : &matrix);
+    m_batchBounds.push_back(bounds);
+    return;
+  }
+
+  flushBatch();
+  bindContext(scissor);
+  plutovg_add_path(m_drawContext, visiblePath);
+
+  // Paths are always composited source over, whatever an image drew with.
+  setComposite(1.0f, plutovg_operator_src_over);
+  if (paintData->m_shader != nullptr)
+  {
+    const auto* shaderData = reinterpret_cast<PlutoVG_RenderShader*>(paintData->m_shader.get());
+    setGradientSource(m_format == PlutoVG_PixelFormat::rgba8888 ? shaderData->swappedGradient() : shaderData->m_gradient);
+  }
+  else
+  {
+    setColorSource(paintData->m_color);
+  }
+
+  switch (paintData->m_style)
+  {
+    case RenderPaintStyle::fill:
+      setFillRule(pathData->m_fillRule);
+      plutovg_fill(m_drawContext);
+      break;
+
+    case RenderPaintStyle::stroke:
+      setStroke(paintData->m_thickness, ToPlutoVG::convert(paintData->m_cap), ToPlutoVG::convert(paintData->m_join));
+      plutovg_stroke(m_drawContext);
+      break;
+  }
+}
+
+void PlutoVG_Renderer::drawImage(const RenderImage* image, BlendMode blendMode, float opacity)
+{
+  if (!attached())
+    return;
+
+  const auto* imageData = reinterpret_cast<const PlutoVG_RenderImage*>(image);
+
+  const PlutoVG_IRect extent = deviceBounds(0.0f, 0.0f, static_cast<float>(imageData->m_Width), static_cast<float>(imageData->m_Height), 0.0f);
+  const PlutoVG_IRect bounds = visibleBounds(extent);
+  if (bounds.empty())
+    return;
+  m_damage = m_damage.united(bounds);
+
+  // Images cover their rectangle in a8 buffers, their texels are never read.
+  if (m_coverage != nullptr)
+  {
+    const PlutoVG_IRect area = m_state.clip != nullptr ? bounds.intersected(m_state.clip->view) : bounds;
+    if (area.empty())
+      return;
+
+    const auto width = static_cast<float>(imageData->m_Width);
+    const auto height = static_cast<float>(imageData->m_Height);
+    const Vec2D corners[] = {Vec2D(0.0f, 0.0f), Vec2D(width, 0.0f), Vec2D(width, height), Vec2D(0.0f, height)};
+    m_coverage->reset(area);
+    m_coverage->fillPolygon(corners, 4, m_state.matrix);
+    compositeCoverage(plutovg_fill_rule_non_zero, area);
+    return;
+  }
+  const bool scissor = crossesScissor(extent);
+
+  flushBatch();
+  plutovg_texture_t* texture = imageData->threadTexture(m_format == PlutoVG_PixelFormat::rgba8888);
+  if (blendMode == BlendMode::srcOver && blitImage(texture, opacity))
+    return;
+
+  bindContext(scissor);
+  plutovg_rect(m_drawContext, 0, 0, imageData->m_Width, imageData->m_Height);
+  setTextureSource(texture);
+  setComposite(opacity, ToPlutoVG::convert(blendMode));
+  plutovg_fill(m_drawContext);
+}
+
+void PlutoVG_Renderer::drawImageMesh(const RenderImage* image,
+  rcp<RenderBuffer> vertices,
+  rcp<RenderBuffer> uvCoords,
+  rcp<RenderBuffer> indices,
+  BlendMode blendMode,
+  float opacity)
+{
+  // if (m_context == nullptr)
+  //   return;
+
+  // // need our vertices and uvs to agree
+  // assert(vertices->count() == uvCoords->count());
+  // // vertices and uvs are arrays of floats, so we need their counts to be
+  // // even, since we treat them as arrays of points
+  // assert((vertices->count() & 1) == 0);
+
+  // // const int vertexCount = vertices->count() >> 1;
+
+  // plutovg_matrix_t matrix;
+  // plutovg_matrix_init_identity(&matrix);
+
+  // // auto uvs = (const plutovg_point_t *)DataRenderBuffer::Cast(uvCoords.get())->vecs();
+
+  // const auto* imageData = reinterpret_cast<const PlutoVG_RenderImage*>(image);
+
+  // plutovg_set_source_texture(m_context, imageData->m_texture);
+  // plutovg_set_opacity(m_context, opacity);
+  // plutovg_set_operator(m_context, ToPlutoVG::convert(blendMode));
+  // plutovg_set_matrix(m_context, &matrix);
+  // plutovg_paint(m_context);
+}
+
+// Fills merged into one path keep their own coverage only if no two of them
+// overlap: overlapping shapes would add up their winding, and a translucent
+// color would no longer be blended twice where they meet.
+bool PlutoVG_Renderer::canBatch(unsigned int color, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& bounds) const
+{
+  if (m_batchBounds.empty())
+    return true;
+  if (color != m_batchColor || fillRule != m_batchFillRule || m_batchBounds.size() >= kMaxBatchSize)
+    return false;
+
+  for (const PlutoVG_IRect& other : m_batchBounds)
+  {
+    if (!other.intersected(bounds).empty())
+      return false;
+  }
+  return true;
+}
+
+// Batched fills are stored in device space, so draws made under different
+// transforms end up in one rasterization and one composite pass.
+void PlutoVG_Renderer::flushBatch()
+{
+  if (m_batchBounds.empty())
+    return;
+
+  // Batched fills never cross the scissor.
+  bindContext(false);
+  setDeviceMatrix(Mat2D());
+  setComposite(1.0f, plutovg_operator_src_over);
+  setColorSource(m_batchColor);
+  setFillRule(m_batchFillRule);
+  plutovg_add_path(m_drawContext, m_batchPath);
+  plutovg_fill(m_drawContext);
+
+  plutovg_path_clear(m_batchPath);
+  m_batchBounds.clear();
+}
+
+// Images moved by whole pixels map texels to pixels one to one: without a clip
+// level to intersect with, their visible rows are composited directly.
+bool PlutoVG_Renderer::blitImage(plutovg_texture_t* texture, float opacity)
+{
+  if (m_state.matrixType > PlutoVG_MatrixType::translate || m_state.clip != nullptr)
+    return false;
+
+  const float tx = m_state.matrix[4];
+  const float ty = m_state.matrix[5];
+  if (tx != std::floor(tx) || ty != std::floor(ty) || std::abs(tx) > 1e6f || std::abs(ty) > 1e6f)
+    return false;
+
+  const plutovg_surface_t* image = plutovg_texture_get_surface(texture);
+  const PlutoVG_IRect rect{static_cast<int>(tx), static_cast<int>(ty), plutovg_surface_get_width(image), plutovg_surface_get_height(image)};
+  const PlutoVG_IRect bounds = visibleBounds(rect.intersected(PlutoVG_IRect{0, 0, width(), height()}));
+  if (bounds.empty())
+    return true;
+
+  const uint8_t* imageData = plutovg_surface_get_data(image);
+  const int imageStride = plutovg_surface_get_stride(image);
+  const int offsetX = bounds.x - rect.x;
+  const int offsetY = bounds.y - rect.y;
+
+  uint8_t* data = plutovg_surface_get_data(m_surface);
+  const int stride = this->stride();
+  const auto alpha = static_cast<uint32_t>(std::lround(std::min(std::max(opacity, 0.0f), 1.0f) * 255.0f));
+  for (int y = 0; y < bounds.height; y++)
+  {
+    const auto* src = reinterpret_cast<const uint32_t*>(imageData + static_cast<size_t>(imageStride) * (offsetY + y)) + offsetX;
+    auto* dst = reinterpret_cast<uint32_t*>(data + static_cast<size_t>(stride) * (bounds.y + y)) + bounds.x;
+    PixelOps::blendSrcOver(src, dst, bounds.width, alpha);
+  }
+  return true;
+}
+
+// Composites the shape rasterized over `area` into the a8 buffer, under the
+// mask of the clip level if there is one, whose view holds the area.
+void PlutoVG_Renderer::compositeCoverage(plutovg_fill_rule_t fillRule, const PlutoVG_IRect& area)
+{
+  uint8_t* data = m_target + static_cast<size_t>(m_targetStride) * area.y + area.x;
+  const ClipLevel* clip = m_state.clip.get();
+  if (clip == nullptr)
+  {
+    m_coverage->composite(fillRule, data, m_targetStride, nullptr, 0);
+    return;
+  }
+
+  const uint8_t* mask = clip->mask.data() + static_cast<size_t>(clip->view.width) * (area.y - clip->view.y) + (area.x - clip->view.x);
+  m_coverage->composite(fillRule, data, m_targetStride, mask, clip->view.width);
+}
+
+bool PlutoVG_Renderer::crossesScissor(const PlutoVG_IRect& bounds) const
+{
+  return m_state.scissored && !m_state.scissor.contains(bounds);
+}
+
+// Picks the context a draw is made with and brings its matrix to the current
+// transform: the context of the clip level, or the unclipped context. Draws
+// crossing the scissor are made in a context over the scissor's pixels alone,
+// where plutovg clips their spans to its surface while rasterizing, which
+// needs no coverage mask. The view is kept for the draws that follow under
+// the same scissor.
+void PlutoVG_Renderer::bindContext(bool scissor)
+{
+  if (m_state.clip != nullptr)
+  {
+    m_drawContext = m_state.clip->context;
+    m_drawState = m_state.clip->owner != nullptr ? m_state.clip->owner : &m_state.clip->state;
+    m_drawX = m_state.clip->view.x;
+    m_drawY = m_state.clip->view.y;
+    setDeviceMatrix(m_state.matrix);
+    return;
+  }
+  if (!scissor)
+  {
+    m_drawContext = m_context;
+    m_drawState = &m_contextState;
+    m_drawX = m_drawY = 0;
+    setDeviceMatrix(m_state.matrix);
+    return;
+  }
+
+  const PlutoVG_IRect& view = m_state.scissor;
+  if (m_scissorContext == nullptr || !(m_scissorView == view))
+  {
+    releaseScissor();
+    const int stride = this->stride();
+    uint8_t* data = plutovg_surface_get_data(m_surface) + static_cast<size_t>(stride) * view.y + view.x * 4;
+    m_scissorSurface = plutovg_surface_create_for_data(data, view.width, view.height, stride);
+    m_scissorContext = plutovg_create(m_scissorSurface);
+    m_scissorView = view;
+    m_scissorState = ContextState();
+  }
+
+  m_drawContext = m_scissorContext;
+  m_drawState = &m_scissorState;
+  m_drawX = view.x;
+  m_drawY = view.y;
+  setDeviceMatrix(m_state.matrix);
+}
+
+void PlutoVG_Renderer::releaseScissor()
+{
+  if (m_scissorContext == nullptr)
+    return;
+
+  plutovg_destroy(m_scissorContext);
+  plutovg_surface_destroy(m_scissorSurface);
+  m_scissorContext = nullptr;
+  m_scissorSurface = nullptr;
+}
+
+PlutoVG_Renderer::ClipLevel::~ClipLevel()
+{
+  if (owner != nullptr)
+  {
+    plutovg_restore(context);
+    *owner = ownerSaved;
+  }
+  else if (context != nullptr)
+  {
+    plutovg_destroy(context);
+    plutovg_surface_destroy(surface);
+  }
+  plutovg_path_destroy(path);
+}
+
+rcp<PlutoVG_Renderer::ClipLevel> PlutoVG_Renderer::findClipLevel(uint64_t generation, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& rect)
+{
+  for (const rcp<ClipLevel>& level : m_clipLevels)
+  {
+    if (level->parent.get() == m_state.clip.get() && level->generation == generation && level->fillRule == fillRule && level->rect == rect && (generation == 0 || level->matrix == m_state.matrix))
+    {
+      level->frame = m_frame;
+      m_frameUsedClips = true;
+      return level;
+    }
+  }
+  return nullptr;
+}
+
+// Whether a path clipped with has changed since the previous frame, or is
+// clipped again under another transform: animated clips, which would miss the
+// cache every frame.
+bool PlutoVG_Renderer::clipChanges(uint64_t generation) const
+{
+  if (generation > m_frameGeneration)
+    return true;
+
+  for (const rcp<ClipLevel>& level : m_clipLevels)
+  {
+    if (level->parent.get() == m_state.clip.get() && level->generation == generation)
+      return true;
+  }
+  return false;
+}
+
+// Contexts cannot share their clip, the new level's context clips to every
+// level above it in turn, once. `view` is the device bounds of the clip.
+rcp<PlutoVG_Renderer::ClipLevel> PlutoVG_Renderer::makeClipLevel(plutovg_path_t* devicePath, uint64_t generation, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& rect, const PlutoVG_IRect& view, bool cached)
+{
+  rcp<ClipLevel> level(new ClipLevel());
+  level->parent = m_state.clip;
+  level->generation = generation;
+  level->matrix = m_state.matrix;
+  level->fillRule = fillRule;
+  level->rect = rect;
+  level->path = devicePath;
+  level->view = view;
+  level->frame = m_frame;
+  m_frameUsedClips = true;
+  if (cached)
+    m_clipLevels.push_back(level);
+  if (view.empty())
+    return level;
+
+  // a8 levels rasterize the clip once, under the mask of the parent, which
+  // is all the draws made under them need.
+  if (m_coverage != nullptr)
+  {
+    level->mask.assign(static_cast<size_t>(view.width) * view.height, 0);
+    const ClipLevel* parent = level->parent.get();
+    const PlutoVG_IRect area = parent != nullptr ? view.intersected(parent->view) : view;
+    if (area.empty())
+      return level;
+
+    const uint8_t* parentMask = nullptr;
+    if (parent != nullptr)
+      parentMask = parent->mask.data() + static_cast<size_t>(parent->view.width) * (area.y - parent->view.y) + (area.x - parent->view.x);
+    m_coverage->reset(area);
+    m_coverage->fillPath(devicePath, Mat2D());
+    m_coverage->composite(fillRule, level->mask.data() + static_cast<size_t>(view.width) * (area.y - view.y) + (area.x - view.x), view.width, parentMask, parent != nullptr ? parent->view.width : 0);
+    return level;
+  }
+
+  const int stride = this->stride();
+  uint8_t* data = plutovg_surface_get_data(m_surface) + static_cast<size_t>(stride) * view.y + view.x * 4;
+  level->surface = plutovg_surface_create_for_data(data, view.width, view.height, stride);
+  level->context = plutovg_create(level->surface);
+
+  // Device paths are clipped from the view's origin.
+  const Mat2D origin(1.0f, 0.0f, 0.0f, 1.0f, static_cast<float>(-view.x), static_cast<float>(-view.y));
+  const plutovg_matrix_t matrix = ToPlutoVG::convert(origin);
+  plutovg_set_matrix(level->context, &matrix);
+
+  std::vector<const ClipLevel*> chain;
+  for (const ClipLevel* ancestor = level.get(); ancestor != nullptr; ancestor = ancestor->parent.get())
+    chain.push_back(ancestor);
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it)
+  {
+    plutovg_set_fill_rule(level->context, (*it)->fillRule);
+    plutovg_add_path(level->context, (*it)->path);
+    plutovg_clip(level->context);
+  }
+  level->state.matrix = origin;
+  level->state.fillRule = fillRule;
+
+  return level;
+}
+
+// Clips the context of the current level, or the renderer's own, in place
+// until the level is released: one clip, where a level of its own replays
+// every level above it. Levels made under it are clipped in place as well,
+// they are never cached. `view` is the device bounds of the clip.
+rcp<PlutoVG_Renderer::ClipLevel> PlutoVG_Renderer::clipInPlace(plutovg_path_t* devicePath, plutovg_fill_rule_t fillRule, const PlutoVG_IRect& view)
+{
+  ClipLevel* parent = m_state.clip.get();
+  rcp<ClipLevel> level(new ClipLevel());
+  level->parent = m_state.clip;
+  level->fillRule = fillRule;
+  level->path = devicePath;
+  level->view = view;
+  if (view.empty())
+    return level;
+
+  level->view = parent != nullptr ? parent->view : PlutoVG_IRect{0, 0, width(), height()};
+  level->context = parent != nullptr ? parent->context : m_context;
+  level->owner = parent == nullptr ? &m_contextState : parent->owner != nullptr ? parent->owner : &parent->state;
+  level->ownerSaved = *level->owner;
+  plutovg_save(level->context);
+
+  const Mat2D origin(1.0f, 0.0f, 0.0f, 1.0f, static_cast<float>(-level->view.x), static_cast<float>(-level->view.y));
+  const plutovg_matrix_t matrix = ToPlutoVG::convert(origin);
+  plutovg_set_matrix(level->context, &matrix);
+  plutovg_set_fill_rule(level->context, fillRule);
+  plutovg_add_path(level->context, devicePath);
+  plutovg_clip(level->context);
+  level->owner->matrix = origin;
+  level->owner->fillRule = fillRule;
+
+  return level;
+}
+
+// Clip levels no frame has used for a while are dropped, those still saved or
+// current are only forgotten by the cache. Frames using no clip level are not
+// counted, so that clear() and reset() can end frames restore() already ended.
+void PlutoVG_Renderer::endFrame()
+{
+  m_frameGeneration = s_pathGenerations;
+  if (!m_frameUsedClips)
+    return;
+
+  m_frameUsedClips = false;
+  m_frame++;
+  m_clipLevels.erase(std::remove_if(m_clipLevels.begin(), m_clipLevels.end(), [this](const rcp<ClipLevel>& level) { return level->frame + kClipLevelFrames < m_frame; }), m_clipLevels.end());
+}
+
+void PlutoVG_Renderer::discardBatch()
+{
+  if (m_batchPath != nullptr)
+    plutovg_path_clear(m_batchPath);
+  m_batchBounds.clear();
+}
+
+void PlutoVG_Renderer::completeDraws()
+{
+  // Pending fills are part of the pixels the caller is about to read.
+  flushBatch();
+}
+
+PlutoVG_IRect PlutoVG_Renderer::visibleBounds(const PlutoVG_IRect& bounds) const
+{
+  return m_state.clipped ? bounds.intersected(m_state.clipBounds) : bounds;
+}
+
+// Bounds of the transformed corners of a rectangle. Without rotation or skew
+// two opposite corners are enough.
+static void transformBounds(const Mat2D& matrix, PlutoVG_MatrixType type, float minX, float minY, float maxX, float maxY, float& left, float& top, float& right, float& bottom)
+{
+  if (type != PlutoVG_MatrixType::affine)
+  {
+    const float x0 = matrix[0] * minX + matrix[4], x1 = matrix[0] * maxX + matrix[4];
+    const float y0 = matrix[3] * minY + matrix[5], y1 = matrix[3] * maxY + matrix[5];
+    left = std::min(x0, x1);
+    right = std::max(x0, x1);
+    top = std::min(y0, y1);
+    bottom = std::max(y0, y1);
+    return;
+  }
+
+  const Vec2D corners[] = {
+    matrix * Vec2D(minX, minY),
+    matrix * Vec2D(maxX, minY),
+    matrix * Vec2D(maxX, maxY),
+    matrix * Vec2D(minX, maxY),
+  };
+
+  left = right = corners[0].x;
+  top = bottom = corners[0].y;
+  for (const Vec2D& corner : corners)
+  {
+    left = std::min(left, corner.x);
+    top = std::min(top, corner.y);
+    right = std::max(right, corner.x);
+    bottom = std::max(bottom, corner.y);
+  }
+}
+
+// Outsets scale with the longest axis of the transform, plus a pixel for
+// antialiasing.
+float PlutoVG_Renderer::devicePad(float outset) const
+{
+  const Mat2D& matrix = m_state.matrix;
+  float scale = 1.0f;
+  if (m_state.matrixType == PlutoVG_MatrixType::scaleTranslate)
+    scale = std::max(std::abs(matrix[0]), std::abs(matrix[3]));
+  else if (m_state.matrixType == PlutoVG_MatrixType::affine)
+    scale = std::max(std::sqrt(matrix[0] * matrix[0] + matrix[1] * matrix[1]), std::sqrt(matrix[2] * matrix[2] + matrix[3] * matrix[3]));
+  return outset * scale + 1.0f;
+}
+
+// Segments lying entirely past one edge of the visible area (expanded by the
+// reach of strokes and antialiasing) are replaced, along with the segments
+// following them past the same edge, by a single line between the first
+// and last of their points. The run and that line form a loop on the far
+// side of the edge, which leaves the winding of every visible point as it
+// was: plutovg only flattens and walks the edges that can be seen. Points are
+// tested in device space but the output stays in user space, kept points are
+// the original ones.
+const plutovg_path_t* PlutoVG_Renderer::preClip(const plutovg_path_t* path, float minX, float minY, float maxX, float maxY, float outset)
+{
+  const PlutoVG_IRect view = m_state.clipped ? m_state.clipBounds : PlutoVG_IRect{0, 0, width(), height()};
+  const float margin = devicePad(outset);
+  const float viewLeft = view.x - margin, viewTop = view.y - margin;
+  const float viewRight = view.x + view.width + margin, viewBottom = view.y + view.height + margin;
+
+  float left, top, right, bottom;
+  transformBounds(m_state.matrix, m_state.matrixType, minX, minY, maxX, maxY, left, top, right, bottom);
+  if (left >= viewLeft && top >= viewTop && right <= viewRight && bottom <= viewBottom)
+    return path;
+
+  if (m_preClipPath == nullptr)
+    m_preClipPath = plutovg_path_create();
+  else
+    plutovg_path_clear(m_preClipPath);
+
+  const Mat2D& matrix = m_state.matrix;
+  const bool affine = m_state.matrixType == PlutoVG_MatrixType::affine;
+  auto outside = [&](const plutovg_point_t& point)
+  {
+    double x = matrix[0] * point.x + matrix[4];
+    double y = matrix[3] * point.y + matrix[5];
+    if (affine)
+    {
+      x += matrix[2] * point.y;
+      y += matrix[1] * point.x;
+    }
+    return (x < viewLeft ? 1 : 0) | (x > viewRight ? 2 : 0) | (y < viewTop ? 4 : 0) | (y > viewBottom ? 8 : 0);
+  };
+
+  const int elementCount = plutovg_path_get_element_count(path);
+  const plutovg_path_element_t* elements = plutovg_path_get_elements(path);
+  const plutovg_point_t* points = plutovg_path_get_points(path);
+
+  // Edges shared by the current run of collapsed segments, and its last point.
+  int runSides = 0;
+  plutovg_point_t runEnd{0, 0};
+  int currentSides = 0;
+  // Sides of the contour's move point, where a close leaves the pen.
+  int startSides = 0;
+  auto endRun = [&]()
+  {
+    if (runSides != 0)
+      plutovg_path_line_to(m_preClipPath, runEnd.x, runEnd.y);
+    runSides = 0;
+  };
+
+  for (int i = 0; i < elementCount; i++)
+  {
+    switch (elements[i])
+    {
+      case plutovg_path_element_move_to:
+        endRun();
+        plutovg_path_move_to(m_preClipPath, points[0].x, points[0].y);
+        currentSides = startSides = outside(points[0]);
+        points += 1;
+        break;
+
+      case plutovg_path_element_line_to:
+      case plutovg_path_element_cubic_to:
+      {
+        const int count = elements[i] == plutovg_path_element_line_to ? 1 : 3;
+        int sides = currentSides;
+        for (int j = 0; j < count; j++)
+          sides &= outside(points[j]);
+
+        if (sides != 0 && (sides & runSides) != 0)
+        {
+          runSides &= sides;
+        }
+        else
+        {
+          endRun();
+          if (sides != 0)
+            runSides = sides;
+          else if (count == 1)
+            plutovg_path_line_to(m_preClipPath, points[0].x, points[0].y);
+          else
+            plutovg_path_cubic_to(m_preClipPath, points[0].x, points[0].y, points[1].x, points[1].y, points[2].x, points[2].y);
+        }
+
+        runEnd = points[count - 1];
+        currentSides = outside(points[count - 1]);
+        points += count;
+        break;
+      }
+
+      case plutovg_path_element_close:
+        endRun();
+        plutovg_path_close(m_preClipPath);
+        currentSides = startSides;
+        points += 1;
+        break;
+    }
+  }
+  endRun();
+
+  return m_preClipPath;
+}
+
+PlutoVG_IRect PlutoVG_Renderer::deviceBounds(float minX, float minY, float maxX, float maxY, float outset) const
+{
+  float left, top, right, bottom;
+  transformBounds(m_state.matrix, m_state.matrixType, minX, minY, maxX, maxY, left, top, right, bottom);
+  const float pad = devicePad(outset);
+
+  const PlutoVG_IRect bounds{0, 0, width(), height()};
+  if (!std::isfinite(left + top + right + bottom + pad))
+    return bounds;
+
+  const float limit = static_cast<float>(std::max(bounds.width, bounds.height)) + 1.0f;
+  const int x0 = static_cast<int>(std::floor(std::max(left - pad, -1.0f)));
+  const int y0 = static_cast<int>(std::floor(std::max(top - pad, -1.0f)));
+  const int x1 = static_cast<int>(std::ceil(std::min(right + pad, limit)));
+  const int y1 = static_cast<int>(std::ceil(std::min(bottom + pad, limit)));
+  return PlutoVG_IRect{x0, y0, x1 - x0, y1 - y0}.intersected(bounds);
+}
+
+void PlutoVG_Renderer::clear()
+{
+  // Pending fills would only be cleared again.
+  discardBatch();
+  endFrame();
+  if (!attached() || m_damage.empty())
+    return;
+
+  uint8_t* data = m_coverage != nullptr ? m_target : plutovg_surface_get_data(m_surface);
+  const int stride = this->stride();
+  const int bytesPerPixel = m_coverage != nullptr ? 1 : 4;
+  PixelOps::clearRows(data + static_cast<size_t>(stride) * m_damage.y + m_damage.x * bytesPerPixel, stride, m_damage.width * bytesPerPixel, m_damage.height);
+  m_damage = {};
+}
+
+void PlutoVG_Renderer::flush()
+{
+  if (!attached())
+    return;
+
+  flushBatch();
+  if (!usesWorkingSurface(m_format))
+    return;
+
+  const uint8_t* data = this->data();
+  const int width = this->width();
+  const int height = this->height();
+  const int stride = this->stride();
+  for (int y = 0; y < height; y++)
+  {
+    const auto* src = reinterpret_cast<const uint32_t*>(data + static_cast<size_t>(stride) * y);
+    uint8_t* dst = m_target + static_cast<size_t>(m_targetStride) * y;
+    PixelOps::argbToRGB565(src, reinterpret_cast<uint16_t*>(dst), width);
+  }
+}
+
+int PlutoVG_Renderer::width() const
+{
+  if (m_coverage != nullptr)
+    return m_targetWidth;
+  if (m_surface == nullptr)
+    return 0;
+
+  return plutovg_surface_get_width(m_surface);
+}
+
+int PlutoVG_Renderer::height() const
+{
+  if (m_coverage != nullptr)
+    return m_targetHeight;
+  if (m_surface == nullptr)
+    return 0;
+
+  return plutovg_surface_get_height(m_surface);
+}
+
+int PlutoVG_Renderer::stride() const
+{
+  if (m_coverage != nullptr)
+    return m_targetStride;
+  if (m_surface == nullptr)
+    return 0;
+
+  return plutovg_surface_get_stride(m_surface);
+}
+
+uint8_t* PlutoVG_Renderer::data()
+{
+  if (m_coverage != nullptr)
+    return m_target;
+  if (m_surface == nullptr)
+    return nullptr;
+
+  completeDraws();
+  return plutovg_surface_get_data(m_surface);
+}
+
+void PlutoVG_HashRenderer::mix(uint64_t value)
+{
+  m_hash = hashMix(m_hash, value);
+}
+
+void PlutoVG_HashRenderer::mix(float value)
+{
+  m_hash = hashMix(m_hash, value);
+}
+
+void PlutoVG_HashRenderer::mixPath(const RenderPath* path)
+{
+  const auto* pathData = reinterpret_cast<const PlutoVG_RenderPath*>(path);
+  pathData->settle();
+
+  mix(static_cast<uint64_t>(pathData->m_verbs.size()));
+  for (const PathVerb verb : pathData->m_verbs)
+    mix(static_cast<uint64_t>(verb));
+
+  for (const Vec2D& point : pathData->m_points)
+  {
+    mix(point.x);
+    mix(point.y);
+  }
+
+  mix(static_cast<uint64_t>(pathData->m_fillRule));
+}
+
+void PlutoVG_HashRenderer::save()
+{
+  mix(uint64_t(1));
+}
+
+void PlutoVG_HashRenderer::restore()
+{
+  mix(uint64_t(2));
+}
+
+void PlutoVG_HashRenderer::transform(const Mat2D& transform)
+{
+  mix(uint64_t(3));
+  for (int i = 0; i < 6; i++)
+    mix(transform[i]);
+}
+
+void PlutoVG_HashRenderer::clipPath(RenderPath* path)
+{
+  mix(uint64_t(4));
+  mixPath(path);
+}
+
+void PlutoVG_HashRenderer::drawPath(RenderPath* path, RenderPaint* paint)
+{
+  const auto* paintData = reinterpret_cast<PlutoVG_RenderPaint*>(paint);
+
+  mix(uint64_t(5));
+  mixPath(path);
+  mix(static_cast<uint64_t>(paintData->m_style));
+  mix(static_cast<uint64_t>(paintData->m_blendMode));
+  if (paintData->m_shader != nullptr)
+    mix(reinterpret_cast<PlutoVG_RenderShader*>(paintData->m_shader.get())->m_hash);
+  else
+    mix(static_cast<uint64_t>(paintData->m_color));
+
+  if (paintData->m_style == RenderPaintStyle::stroke)
+  {
+    mix(paintData->m_thickness);
+    mix(static_cast<uint64_t>(paintData->m_cap));
+    mix(static_cast<uint64_t>(paintData->m_join));
+  }
+}
+
+void PlutoVG_HashRenderer::drawImage(const RenderImage* image, BlendMode blendMode, float opacity)
+{
+  // Decoded images are immutable, their identity is enough.
+  mix(uint64_t(6));
+  mix(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(image)));
+  mix(static_cast<uint64_t>(blendMode));
+  mix(opacity);
+}
+
+void PlutoVG_HashRenderer::drawImageMesh(const RenderImage* image,
+  rcp<RenderBuffer> vertices,
+  rcp<RenderBuffer> uvCoords,
+  rcp<RenderBuffer> indices,
+  BlendMode blendMode,
+  float opacity)
+{
+  // Image meshes are not rasterized by PlutoVG_Renderer yet, so they cannot
+  // change the output.
+}
+
+// Pixels of rgba8888 renderers are already in order, a8 coverage becomes the
+// alpha of black pixels. Rows are width * 4 bytes apart.
+static uint8_t* toRGBA(const uint8_t* data, int width, int height, int stride, PlutoVG_PixelFormat format)
+{
+  const size_t rowBytes = static_cast<size_t>(width) * 4;
+  auto* image = static_cast<uint8_t*>(calloc(1, rowBytes * height));
+
+  for (int y = 0; y < height; y++)
+  {
+    const uint8_t* row = data + static_cast<size_t>(stride) * y;
+    uint8_t* dst = image + rowBytes * y;
+    if (format == PlutoVG_PixelFormat::a8)
+    {
+      for (int x = 0; x < width; x++)
+        dst[x * 4 + 3] = row[x];
+    }
+    else if (format == PlutoVG_PixelFormat::rgba8888)
+    {
+      memcpy(dst, row, rowBytes);
+    }
+    else
+    {
+      PixelOps::argbToRGBA(reinterpret_cast<const uint32_t*>(row), reinterpret_cast<uint32_t*>(dst), width);
+    }
+  }
+
+  return image;
+}
+
+static void appendToVector(void* context, void* data, int size)
+{
+  auto* output = static_cast<std::vector<uint8_t>*>(context);
+  const auto* bytes = static_cast<const uint8_t*>(data);
+  output->insert(output->end(), bytes, bytes + size);
+}
+
+void PlutoVG_Renderer::writePNG(const char* filename)
+{
+  if (!attached())
+    return;
+
+  const int width = this->width();
+  const int height = this->height();
+  const int stride = this->stride();
+
+  auto* image = toRGBA(this->data(), width, height, stride, m_format);
+  stbi_write_png(filename, width, height, 4, image, width * 4);
+  free(image);
+}
+
+std::vector<uint8_t> PlutoVG_Renderer::encodePNG()
+{
+  std::vector<uint8_t> output;
+  if (!attached())
+    return output;
+
+  const int width = this->width();
+  const int height = this->height();
+  const int stride = this->stride();
+
+  auto* image = toRGBA(this->data(), width, height, stride, m_format);
+  if (stbi_write_png_to_func(appendToVector, &output, width, height, 4, image, width * 4) == 0)
+    output.clear();
+
+  free(image);
+  return output;
+}
+
+std::vector<uint8_t> PlutoVG_Renderer::encodeQOI()
+{
+  std::vector<uint8_t> output;
+  if (!attached())
+    return output;
+
+  const uint8_t* data = this->data();
+  const int width = this->width();
+  const int height = this->height();
+  const int stride = this->stride();
+
+  auto put32 = [&output](uint32_t value)
+  {
+    output.push_back(value >> 24 & 255);
+    output.push_back(value >> 16 & 255);
+    output.push_back(value >> 8 & 255);
+    output.push_back(value >> 0 & 255);
+  };
+
+  output.reserve(22 + static_cast<size_t>(width) * height * 2);
+  output.insert(output.end(), {'q', 'o', 'i', 'f'});
+  put32(width);
+  put32(height);
+  output.push_back(4); // RGBA
+  output.push_back(0); // sRGB with linear alpha
+
+  // Pixels are compared packed as 0xRRGGBBAA, like the encoded stream.
+  const int redShift = m_format == PlutoVG_PixelFormat::rgba8888 ? 0 : 16;
+  uint32_t index[64] = {0};
+  uint32_t previous = 255;
+  int run = 0;
+
+  for (int y = 0; y < height; y++)
+  {
+    const uint8_t* row = data + static_cast<size_t>(stride) * y;
+    const auto* src = reinterpret_cast<const uint32_t*>(row);
+    for (int x = 0; x < width; x++)
+    {
+      // a8 coverage is encoded as the alpha of black pixels.
+      const uint32_t value = m_format == PlutoVG_PixelFormat::a8 ? static_cast<uint32_t>(row[x]) << 24 : src[x];
+      const uint32_t a = value >> 24;
+      const uint32_t r = value >> redShift & 255;
+      const uint32_t g = value >> 8 & 255;
+      const uint32_t b = value >> (16 - redShift) & 255;
+      const uint32_t pixel = (r << 24) | (g << 16) | (b << 8) | a;
+
+      if (pixel == previous)
+      {
+        if (++run == 62)
+        {
+          output.push_back(0xc0 | (run - 1));
+          run = 0;
+        }
+        continue;
+      }
+
+      if (run > 0)
+      {
+        output.push_back(0xc0 | (run - 1));
+        run = 0;
+      }
+
+      const uint32_t hash = (r * 3 + g * 5 + b * 7 + a * 11) % 64;
+      if (index[hash] == pixel)
+      {
+        output.push_back(hash);
+      }
+      else
+      {
+        index[hash] = pixel;
+
+        if (a == (previous & 255))
+        {
+          const int dr = static_cast<int8_t>(r - (previous >> 24));
+          const int dg = static_cast<int8_t>(g - (previous >> 16 & 255));
+          const int db = static_cast<int8_t>(b - (previous >> 8 & 255));
+          const int dgr = dr - dg;
+          const int dgb = db - dg;
+
+          if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+          {
+            output.push_back(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+          }
+          else if (dg >= -32 && dg <= 31 && dgr >= -8 && dgr <= 7 && dgb >= -8 && dgb <= 7)
+          {
+            output.push_back(0x80 | (dg + 32));
+            output.push_back((dgr + 8) << 4 | (dgb + 8));
+          }
+          else
+          {
+            output.insert(output.end(), {0xfe, static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b)});
+          }
+        }
+        else
+        {
+          output.insert(output.end(), {0xff, static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b), static_cast<uint8_t>(a)});
+        }
+      }
+
+      previous = pixel;
+    }
+  }
+
+  if (run > 0)
+    output.push_back(0xc0 | (run - 1));
+
+  output.insert(output.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+  return output;
+}
+
+PlutonRiver_Factory::PlutonRiver_Factory()
+  : m_pathPool(new PlutoVG_PathPool())
+{
+}
+
+PlutonRiver_Factory::~PlutonRiver_Factory() = default;
+
+rcp<RenderBuffer> PlutonRiver_Factory::makeBufferU16(Span<const uint16_t> data)
+{
+  return DataRenderBuffer::Make(data);
+}
+
+rcp<RenderBuffer> PlutonRiver_Factory::makeBufferU32(Span<const uint32_t> data)
+{
+  return DataRenderBuffer::Make(data);
+}
+
+rcp<RenderBuffer> PlutonRiver_Factory::makeBufferF32(Span<const float> data)
 {
   return DataRenderBuffer::Make(data);
 }
 
+static std::vector<plutovg_gradient_stop_t> gradientStops(const ColorInt colors[], const float stops[], size_t count)
+{
+  std::vector<plutovg_gradient_stop_t> result(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    result[i].offset = stops[i];
+    result[i].color = ToPlutoVG::convert(colors[i]);
+  }
+
+  return result;
+}
+
 rcp<RenderShader> PlutonRiver_Factory::makeLinearGradient(float sx,
   float sy,
   float ex,
@@ -429,18 +2208,8 @@ rcp<RenderShader> PlutonRiver_Factory::makeLinearGradient(float sx,
   const float stops[],     // [count]
   size_t count)
 {
-  plutovg_gradient_t* gradient = plutovg_gradient_create_linear(sx, sy, ex, ey);
-
-  for (size_t i = 0; i < count; ++i)
-  {
-    plutovg_gradient_stop_t stop;
-    stop.offset = stops[i];
-    stop.color = ToPlutoVG::convert(colors[i]);
-
-    plutovg_gradient_add_stop(gradient, &stop);
-  }
-
-  return rcp<RenderShader>(new PlutoVG_RenderShader(gradient));
+  const float params[] = {sx, sy, ex, ey};
+  return rcp<RenderShader>(new PlutoVG_RenderShader(false, params, gradientStops(colors, stops, count), hashGradient(0, params, 4, colors, stops, count)));
 }
 
 rcp<RenderShader> PlutonRiver_Factory::makeRadialGradient(float cx,
@@ -450,36 +2219,19 @@ rcp<RenderShader> PlutonRiver_Factory::makeRadialGradient(float cx,
   const float stops[],     // [count]
   size_t count)
 {
-  plutovg_gradient_t* gradient = plutovg_gradient_create_radial(cx, cy, radius, cx, cy, 0);
-
-  for (size_t i = 0; i < count; ++i)
-  {
-    plutovg_gradient_stop_t stop;
-    stop.offset = stops[i];
-    stop.color = ToPlutoVG::convert(colors[i]);
-
-    plutovg_gradient_add_stop(gradient, &stop);
-  }
-
-  return rcp<RenderShader>(new PlutoVG_RenderShader(gradient));
+  const float params[] = {cx, cy, radius, 0.0f};
+  return rcp<RenderShader>(new PlutoVG_RenderShader(true, params, gradientStops(colors, stops, count), hashGradient(1, params, 3, colors, stops, count)));
 }
 
 std::unique_ptr<RenderPath>
 PlutonRiver_Factory::makeRenderPath(Span<const Vec2D> points, Span<const PathVerb> verbs, FillRule fillRule)
 {
-  RawPath rawPath(points.data(), points.size(), verbs.data(), verbs.size());
-
-  plutovg_path_t* path = ToPlutoVG::convert(rawPath);
-
-  PlutoVG_RenderPath renderPath(path);
-  renderPath.fillRule(fillRule);
-
-  return std::make_unique<PlutoVG_RenderPath>(renderPath);
+  return std::make_unique<PlutoVG_RenderPath>(m_pathPool, verbs, points, fillRule);
 }
 
 std::unique_ptr<RenderPath> PlutonRiver_Factory::makeEmptyRenderPath()
 {
-  return std::make_unique<PlutoVG_RenderPath>();
+  return std::make_unique<PlutoVG_RenderPath>(m_pathPool);
 }
 
 std::unique_ptr<RenderPaint> PlutonRiver_Factory::makeRenderPaint()
@@ -0,0 +1,160 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <plutonriver/surface_pool.hpp>
+
+#include <pixel_ops.hpp>
+
+#include <cstdlib>
+#include <cstring>
+
+using namespace rive;
+
+// New buffers come from calloc, which hands large allocations out as fresh
+// zero pages without writing them: they are only faulted in once drawn to.
+// The buffer starts at the first 64-byte boundary of the allocation, `base`
+// is what is freed.
+static uint8_t* allocateCleared(size_t size, uint8_t*& base)
+{
+  base = static_cast<uint8_t*>(calloc(size + 63, 1));
+  if (base == nullptr)
+    return nullptr;
+
+  return reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(base) + 63) & ~uintptr_t(63));
+}
+
+PlutoVG_SurfacePool::PlutoVG_SurfacePool(size_t maxIdleBytes)
+  : m_maxIdleBytes(maxIdleBytes)
+{
+}
+
+PlutoVG_SurfacePool::~PlutoVG_SurfacePool()
+{
+  // Buffers still acquired belong to their users until released, which must
+  // happen before the pool goes away.
+  trim();
+}
+
+int PlutoVG_SurfacePool::bytesPerPixel(PlutoVG_PixelFormat format)
+{
+  switch (format)
+  {
+    case PlutoVG_PixelFormat::rgb565:
+      return 2;
+    case PlutoVG_PixelFormat::a8:
+      return 1;
+    default:
+      return 4;
+  }
+}
+
+uint8_t* PlutoVG_SurfacePool::acquire(int width, int height, PlutoVG_PixelFormat format, int& stride)
+{
+  Buffer buffer{nullptr, nullptr, width, height, (width * bytesPerPixel(format) + 15) & ~15, format, {}};
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = m_idle.size(); i-- > 0;)
+    {
+      const Buffer& idle = m_idle[i];
+      if (idle.width == width && idle.height == height && idle.format == format)
+      {
+        buffer = idle;
+        m_idle.erase(m_idle.begin() + i);
+        m_idleBytes -= bufferSize(buffer);
+        break;
+      }
+    }
+  }
+
+  // Recycled buffers are cleared here rather than on release, so the pages
+  // are warm in the cache when drawing starts. Only the area written since
+  // they were handed out is.
+  if (buffer.data != nullptr)
+  {
+    const PlutoVG_IRect& dirty = buffer.dirty;
+    const int pixelBytes = bytesPerPixel(format);
+    if (dirty == PlutoVG_IRect{0, 0, width, height})
+      PixelOps::clear(buffer.data, bufferSize(buffer));
+    else if (!dirty.empty())
+      PixelOps::clearRows(buffer.data + static_cast<size_t>(buffer.stride) * dirty.y + dirty.x * pixelBytes, buffer.stride, dirty.width * pixelBytes, dirty.height);
+    buffer.dirty = {};
+  }
+  else
+  {
+    buffer.data = allocateCleared(bufferSize(buffer), buffer.base);
+    if (buffer.data == nullptr)
+      return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_busy.push_back(buffer);
+  stride = buffer.stride;
+  return buffer.data;
+}
+
+plutovg_surface_t* PlutoVG_SurfacePool::acquireSurface(int width, int height)
+{
+  int stride;
+  uint8_t* data = acquire(width, height, PlutoVG_PixelFormat::argb32Premultiplied, stride);
+  if (data == nullptr)
+    return nullptr;
+
+  return plutovg_surface_create_for_data(data, width, height, stride);
+}
+
+void PlutoVG_SurfacePool::release(uint8_t* data, const PlutoVG_IRect* damage)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t i = 0; i < m_busy.size(); i++)
+  {
+    if (m_busy[i].data != data)
+      continue;
+
+    const PlutoVG_IRect whole{0, 0, m_busy[i].width, m_busy[i].height};
+    m_busy[i].dirty = damage != nullptr ? damage->intersected(whole) : whole;
+    m_idle.push_back(m_busy[i]);
+    m_idleBytes += bufferSize(m_busy[i]);
+    m_busy[i] = m_busy.back();
+    m_busy.pop_back();
+    evict(m_maxIdleBytes);
+    return;
+  }
+}
+
+void PlutoVG_SurfacePool::releaseSurface(plutovg_surface_t* surface, const PlutoVG_IRect* damage)
+{
+  if (surface == nullptr)
+    return;
+
+  uint8_t* data = plutovg_surface_get_data(surface);
+  plutovg_surface_destroy(surface);
+  release(data, damage);
+}
+
+void PlutoVG_SurfacePool::trim()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  evict(0);
+}
+
+void PlutoVG_SurfacePool::evict(size_t maxIdleBytes)
+{
+  size_t count = 0;
+  for (; count < m_idle.size() && m_idleBytes > maxIdleBytes; count++)
+  {
+    m_idleBytes -= bufferSize(m_idle[count]);
+    free(m_idle[count].base);
+  }
+  m_idle.erase(m_idle.begin(), m_idle.begin() + count);
+}
@@ -0,0 +1,175 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <plutonriver/yuv_converter.hpp>
+
+#include <pixel_ops.hpp>
+
+using namespace rive;
+
+static inline uint8_t luma(uint32_t pixel)
+{
+  const int r = pixel >> 16 & 255, g = pixel >> 8 & 255, b = pixel & 255;
+  return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// Converts columns [x, width) of a pair of rows. `row1` is `row0` again on the
+// last row of an odd height, and the last column is doubled on an odd width.
+// U and V samples are `chromaStep` bytes apart, which interleaves them for NV12.
+static void convertScalar(const uint32_t* row0, const uint32_t* row1, int x, int width, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, int chromaStep)
+{
+  for (; x < width; x += 2)
+  {
+    const int x1 = x + 1 < width ? x + 1 : x;
+    const uint32_t pixels[4] = {row0[x], row0[x1], row1[x], row1[x1]};
+
+    y0[x] = luma(pixels[0]);
+    y0[x1] = luma(pixels[1]);
+    if (y1 != nullptr)
+    {
+      y1[x] = luma(pixels[2]);
+      y1[x1] = luma(pixels[3]);
+    }
+
+    int r = 0, g = 0, b = 0;
+    for (uint32_t pixel : pixels)
+    {
+      r += pixel >> 16 & 255;
+      g += pixel >> 8 & 255;
+      b += pixel & 255;
+    }
+    r = (r + 2) >> 2;
+    g = (g + 2) >> 2;
+    b = (b + 2) >> 2;
+
+    const int chroma = x / 2 * chromaStep;
+    u[chroma] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    v[chroma] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+  }
+}
+
+#ifdef PLUTONRIVER_SSE2
+// Splits 8 ARGB32 pixels into their R, G and B channels as 16-bit lanes.
+static inline void splitChannels(const uint32_t* pixels, __m128i& r, __m128i& g, __m128i& b)
+{
+  const __m128i mask = _mm_set1_epi32(255);
+  const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels));
+  const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + 4));
+  r = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 16), mask), _mm_and_si128(_mm_srli_epi32(p1, 16), mask));
+  g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(p0, 8), mask), _mm_and_si128(_mm_srli_epi32(p1, 8), mask));
+  b = _mm_packs_epi32(_mm_and_si128(p0, mask), _mm_and_si128(p1, mask));
+}
+
+// The weighted sum stays below 65536, so unsigned 16-bit lanes never overflow.
+static inline __m128i luma8(__m128i r, __m128i g, __m128i b)
+{
+  __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)), _mm_mullo_epi16(g, _mm_set1_epi16(129)));
+  sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+  return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+}
+
+// Averages of the 2x2 blocks of 16 columns: 8 lanes from a pair of 8 vertical
+// sums per row.
+static inline __m128i average8(__m128i left, __m128i right)
+{
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i sums = _mm_packs_epi32(_mm_madd_epi16(left, ones), _mm_madd_epi16(right, ones));
+  return _mm_srli_epi16(_mm_add_epi16(sums, _mm_set1_epi16(2)), 2);
+}
+
+// Signed weighted sums of averaged channels stay within +-28560.
+static inline __m128i chroma8(__m128i r, __m128i g, __m128i b, short kr, short kg, short kb)
+{
+  __m128i sum = _mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(kr)), _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+  sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(kb)), _mm_set1_epi16(128)));
+  return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+}
+
+// Converts 16 columns of a pair of rows, returns the number of columns done.
+static int convertSSE2(const uint32_t* row0, const uint32_t* row1, int width, uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v, bool interleaved)
+{
+  int x = 0;
+  for (; x + 16 <= width; x += 16)
+  {
+    __m128i luma0[2], luma1[2], sumR[2], sumG[2], sumB[2];
+    for (int half = 0; half < 2; half++)
+    {
+      __m128i r0, g0, b0, r1, g1, b1;
+      splitChannels(row0 + x + half * 8, r0, g0, b0);
+      splitChannels(row1 + x + half * 8, r1, g1, b1);
+
+      luma0[half] = luma8(r0, g0, b0);
+      luma1[half] = luma8(r1, g1, b1);
+      sumR[half] = _mm_add_epi16(r0, r1);
+      sumG[half] = _mm_add_epi16(g0, g1);
+      sumB[half] = _mm_add_epi16(b0, b1);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), _mm_packus_epi16(luma0[0], luma0[1]));
+    if (y1 != nullptr)
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), _mm_packus_epi16(luma1[0], luma1[1]));
+
+    const __m128i r = average8(sumR[0], sumR[1]);
+    const __m128i g = average8(sumG[0], sumG[1]);
+    const __m128i b = average8(sumB[0], sumB[1]);
+    const __m128i cu = _mm_packus_epi16(chroma8(r, g, b, -38, -74, 112), _mm_setzero_si128());
+    const __m128i cv = _mm_packus_epi16(chroma8(r, g, b, 112, -94, -18), _mm_setzero_si128());
+    if (interleaved)
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + x), _mm_unpacklo_epi8(cu, cv));
+    }
+    else
+    {
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), cu);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), cv);
+    }
+  }
+  return x;
+}
+#endif
+
+size_t PlutoVG_YUVConverter::frameSize(int width, int height)
+{
+  const size_t chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+  return static_cast<size_t>(width) * height + chromaWidth * chromaHeight * 2;
+}
+
+void PlutoVG_YUVConverter::convert(PlutoVG_YUVLayout layout, const uint8_t* data, int width, int height, int stride, uint8_t* output)
+{
+  const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+  const bool interleaved = layout == PlutoVG_YUVLayout::nv12;
+
+  uint8_t* planeY = output;
+  uint8_t* planeU = planeY + static_cast<size_t>(width) * height;
+  uint8_t* planeV = interleaved ? planeU + 1 : planeU + static_cast<size_t>(chromaWidth) * chromaHeight;
+  const int chromaStride = interleaved ? chromaWidth * 2 : chromaWidth;
+  const int chromaStep = interleaved ? 2 : 1;
+
+  for (int y = 0; y < height; y += 2)
+  {
+    const bool pair = y + 1 < height;
+    const auto* row0 = reinterpret_cast<const uint32_t*>(data + static_cast<size_t>(stride) * y);
+    const auto* row1 = pair ? reinterpret_cast<const uint32_t*>(data + static_cast<size_t>(stride) * (y + 1)) : row0;
+    uint8_t* y0 = planeY + static_cast<size_t>(width) * y;
+    uint8_t* y1 = pair ? y0 + width : nullptr;
+    uint8_t* u = planeU + static_cast<size_t>(chromaStride) * (y / 2);
+    uint8_t* v = planeV + static_cast<size_t>(chromaStride) * (y / 2);
+
+    int x = 0;
+#ifdef PLUTONRIVER_SSE2
+    x = convertSSE2(row0, row1, width, y0, y1, u, v, interleaved);
+#endif
+    convertScalar(row0, row1, x, width, y0, y1, u, v, chromaStep);
+  }
+}
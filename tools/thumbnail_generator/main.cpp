@@ -13,18 +13,21 @@
 // limitations under the License.
 
 #include <rive/file.hpp>
-#include <rive/math/aabb.hpp>
-
-#include <plutovg.h>
 
 #include <plutonriver/factory.hpp>
-#include <plutonriver/renderer.hpp>
+#include <plutonriver/mapped_file.hpp>
+
+#include "sequence.hpp"
+#include "server.hpp"
+#include "thumbnail.hpp"
 
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <stdio.h>
 #include <string>
 
-std::string getFileName(char* path)
+std::string getFileName(const char* path)
 {
   std::string str(path);
 
@@ -33,71 +36,164 @@ std::string getFileName(char* path)
   return str.substr(from + 1, to - from - 1);
 }
 
+static bool writeFile(const char* path, const std::vector<uint8_t>& bytes)
+{
+  FILE* fp = fopen(path, "wb");
+  if (fp == nullptr)
+    return false;
+
+  const bool success = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+  return fclose(fp) == 0 && success;
+}
+
+static void printUsage()
+{
+  fprintf(stderr,
+    "usage: thumbnail_generator [options] <file.riv> [output]\n"
+    "       thumbnail_generator [options] (--frames|--sprite-sheet|--animated|--video) <target> <file.riv>\n"
+    "       thumbnail_generator --serve <socket|-> [--cache <count>]\n"
+    "\n"
+    "options:\n"
+    "  --artboard <name>       render the named artboard instead of the default one\n"
+    "  --animation <name>      apply the named animation\n"
+    "  --statemachine <name>   advance the named state machine\n"
+    "  --time <seconds>        time to advance the animation or state machine to\n"
+    "  --width <px>, --height <px>, --size <px>\n"
+    "  --sizes <px,px,..>      render several square sizes from a single import\n"
+    "  --format <png|qoi|raw>\n"
+    "\n"
+    "sequence outputs:\n"
+    "  --frames <prefix>       write numbered frames as <prefix>_0000.<ext>\n"
+    "  --sprite-sheet <file>   write a sprite sheet and its <file>.json frame map\n"
+    "  --animated <file>       write an animated GIF (.gif) or animated PNG\n"
+    "  --video <file|->        stream YUV frames to a file, a fifo or stdout\n"
+    "  --video-format <y4m|i420|nv12>\n"
+    "                          y4m by default, i420 and nv12 are headerless\n"
+    "\n"
+    "sequence options:\n"
+    "  --fps <fps>             frame rate of the sequence (30)\n"
+    "  --start <seconds>, --end <seconds>\n"
+    "                          time range, the animation duration by default\n"
+    "  --threads <count>       worker threads, all hardware threads by default\n"
+    "  --dedupe <yes|no>       reference repeated frames instead of rendering them,\n"
+    "                          numbered frames get a <prefix>.json frame map\n");
+}
+
 int main(int argc, char* argv[])
 {
   rive::PlutonRiver_Factory factory;
 
-  if (argc < 2)
+  ThumbnailOptions options;
+  SequenceOptions sequence;
+  const char* inPath = nullptr;
+  const char* outPath = nullptr;
+  const char* endpoint = nullptr;
+  size_t cacheCapacity = 32;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "--", 2) != 0)
+    {
+      if (inPath == nullptr)
+        inPath = argv[i];
+      else if (outPath == nullptr)
+        outPath = argv[i];
+      else
+      {
+        printUsage();
+        return 1;
+      }
+      continue;
+    }
+
+    if (i + 1 >= argc)
+    {
+      fprintf(stderr, "missing value for %s\n", argv[i]);
+      return 1;
+    }
+
+    const std::string key = argv[i] + 2;
+    const char* value = argv[++i];
+    if (key == "serve")
+      endpoint = value;
+    else if (key == "cache")
+      cacheCapacity = strtoul(value, nullptr, 10);
+    else if (!setThumbnailOption(options, key, value) && !setSequenceOption(sequence, key, value))
+    {
+      fprintf(stderr, "invalid option --%s %s\n", key.c_str(), value);
+      return 1;
+    }
+  }
+
+  if (endpoint != nullptr)
+    return runServer(endpoint, cacheCapacity, factory);
+
+  if (inPath == nullptr)
   {
     fprintf(stderr, "must pass source file");
+    printUsage();
     return 1;
   }
-  FILE* fp;
-  fopen_s(&fp, argv[1], "rb");
 
-  const char* outPath;
-  std::string filename;
+  const bool sequenceMode = !sequence.framesPrefix.empty() || !sequence.spriteSheetPath.empty() || !sequence.animatedPath.empty() || !sequence.videoPath.empty();
+
   std::string fullName;
-  if (argc > 2)
+  if (outPath == nullptr && !sequenceMode)
   {
-    outPath = argv[2];
-  }
-  else
-  {
-    filename = getFileName(argv[1]);
-    fullName = filename + ".png";
+    fullName = getFileName(inPath) + imageFormatExtension(options.format);
     outPath = fullName.c_str();
   }
 
-  if (fp == nullptr)
+  auto mapping = rive::PlutonRiver_MappedFile::open(inPath);
+  if (!mapping)
   {
     fprintf(stderr, "Failed to open rive file.\n");
     return 1;
   }
-  fseek(fp, 0, SEEK_END);
-  auto length = ftell(fp);
-  fseek(fp, 0, SEEK_SET);
-  std::vector<uint8_t> bytes(length);
-  if (fread(bytes.data(), 1, length, fp) != length)
-  {
-    fprintf(stderr, "Failed to read rive file.\n");
-    fclose(fp);
-    return 1;
-  }
-  fclose(fp);
 
-  auto file = rive::File::import(rive::toSpan(bytes), &factory);
+  auto file = rive::File::import(mapping->bytes(), &factory);
   if (!file)
   {
     fprintf(stderr, "Failed to read rive file.\n");
     return 1;
   }
-  auto artboard = file->artboardDefault();
-  artboard->advance(0.0f);
-
-  int width = 1024, height = 1024;
 
-  plutovg_surface_t* surface = plutovg_surface_create(width, height);
+  std::string error;
+  if (sequenceMode)
+  {
+    if (!renderSequence(*file, options, sequence, error))
+    {
+      fprintf(stderr, "Failed to render sequence: %s.\n", error.c_str());
+      return 1;
+    }
+    return 0;
+  }
 
-  rive::PlutoVG_Renderer renderer(surface);
-  renderer.save();
-  renderer.align(rive::Fit::cover, rive::Alignment::center,
-    rive::AABB(0, 0, width, height), artboard->bounds());
-  artboard->draw(&renderer);
-  renderer.restore();
+  std::vector<std::vector<uint8_t>> images;
+  if (!renderThumbnails(*file, options, images, error))
+  {
+    fprintf(stderr, "Failed to render thumbnail: %s.\n", error.c_str());
+    return 1;
+  }
 
-  renderer.writePNG(outPath);
-  plutovg_surface_destroy(surface);
+  for (size_t i = 0; i < images.size(); i++)
+  {
+    // With several sizes, the size is appended to the output name: out_64.png.
+    std::string path = outPath;
+    if (!options.sizes.empty())
+    {
+      const size_t dot = path.find_last_of('.');
+      const size_t slash = path.find_last_of("\\/");
+      const size_t at = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : path.size();
+      path.insert(at, "_" + std::to_string(options.sizes[i]));
+    }
+
+    if (!writeFile(path.c_str(), images[i]))
+    {
+      fprintf(stderr, "Failed to write %s.\n", path.c_str());
+      return 1;
+    }
+  }
 
   return 0;
 }
@@ -0,0 +1,500 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sequence.hpp"
+
+#include <plutonriver/animation_encoder.hpp>
+
+#include <plutovg.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+bool setSequenceOption(SequenceOptions& options, const std::string& key, const std::string& value)
+{
+  char* end = nullptr;
+  if (key == "fps")
+  {
+    options.fps = strtof(value.c_str(), &end);
+    return end != value.c_str() && *end == '\0' && options.fps > 0.0f;
+  }
+  if (key == "start")
+  {
+    options.start = strtof(value.c_str(), &end);
+    return end != value.c_str() && *end == '\0' && options.start >= 0.0f;
+  }
+  if (key == "end")
+  {
+    options.end = strtof(value.c_str(), &end);
+    return end != value.c_str() && *end == '\0' && options.end >= 0.0f;
+  }
+  if (key == "threads")
+  {
+    options.threads = static_cast<unsigned int>(strtoul(value.c_str(), &end, 10));
+    return end != value.c_str() && *end == '\0';
+  }
+  if (key == "dedupe")
+  {
+    options.dedupe = value == "1" || value == "true" || value == "yes";
+    return options.dedupe || value == "0" || value == "false" || value == "no";
+  }
+  if (key == "frames")
+  {
+    options.framesPrefix = value;
+    return true;
+  }
+  if (key == "sprite-sheet")
+  {
+    options.spriteSheetPath = value;
+    return true;
+  }
+  if (key == "animated")
+  {
+    options.animatedPath = value;
+    return true;
+  }
+  if (key == "video")
+  {
+    options.videoPath = value;
+    return true;
+  }
+  if (key == "video-format")
+  {
+    if (value == "y4m")
+      options.videoFormat = VideoFormat::y4m;
+    else if (value == "i420")
+      options.videoFormat = VideoFormat::i420;
+    else if (value == "nv12")
+      options.videoFormat = VideoFormat::nv12;
+    else
+      return false;
+
+    return true;
+  }
+
+  return false;
+}
+
+// Sprite sheets are refused past this many pixels, 1 GB of ARGB32.
+static const int64_t kMaxAtlasPixels = int64_t(1) << 28;
+
+static bool writeFile(const std::string& path, const std::vector<uint8_t>& bytes)
+{
+  FILE* fp = fopen(path.c_str(), "wb");
+  if (fp == nullptr)
+    return false;
+
+  const bool success = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+  return fclose(fp) == 0 && success;
+}
+
+static std::string frameFileName(const std::string& prefix, int frame, ImageFormat format)
+{
+  char number[16];
+  snprintf(number, sizeof(number), "_%04d", frame);
+  return prefix + number + imageFormatExtension(format);
+}
+
+static std::string jsonEscape(const std::string& value)
+{
+  std::string result;
+  for (char c : value)
+  {
+    if (c == '"' || c == '\\')
+      result.push_back('\\');
+    result.push_back(c);
+  }
+  return result;
+}
+
+// Each worker owns its own artboard instance and animates it from the start
+// of the sequence, so its state at a given frame is exactly the one a single
+// serial pass would produce; only the frames of its own chunk are rasterized.
+struct SequenceWorker
+{
+  std::unique_ptr<rive::ArtboardInstance> artboard;
+  std::unique_ptr<rive::Scene> scene;
+  int firstFrame{0};
+  int lastFrame{0};
+};
+
+bool renderSequence(rive::File& file, const ThumbnailOptions& options, const SequenceOptions& sequence, std::string& error)
+{
+  if (options.animation.empty() && options.stateMachine.empty())
+  {
+    error = "an animation or a state machine is required";
+    return false;
+  }
+  const int outputCount = !sequence.framesPrefix.empty() + !sequence.spriteSheetPath.empty() + !sequence.animatedPath.empty() + !sequence.videoPath.empty();
+  if (outputCount != 1)
+  {
+    error = "exactly one of frames, sprite-sheet, animated or video is required";
+    return false;
+  }
+
+  std::unique_ptr<rive::ArtboardInstance> artboard;
+  std::unique_ptr<rive::Scene> scene;
+  if (!instantiateArtboard(file, options, artboard, scene, error))
+    return false;
+
+  const float end = sequence.end >= 0.0f ? sequence.end : scene->durationSeconds();
+  if (end < sequence.start)
+  {
+    error = "the sequence needs an end time";
+    return false;
+  }
+
+  const float frameDuration = 1.0f / sequence.fps;
+  const int frameCount = std::max(1, static_cast<int>(std::ceil((end - sequence.start) * sequence.fps - 1e-3f)));
+  const int width = options.width, height = options.height;
+
+  // Video and animated image frames are streamed to their encoder in order
+  // from a single thread, so no more than one frame is held at a time. The
+  // video writer thread overlaps with the rendering instead.
+  const bool video = !sequence.videoPath.empty();
+  const bool animated = !sequence.animatedPath.empty();
+  unsigned int threadCount = video || animated ? 1 : sequence.threads > 0 ? sequence.threads : std::thread::hardware_concurrency();
+  threadCount = std::max(1u, std::min(threadCount, static_cast<unsigned int>(frameCount)));
+
+  // Instances are created up front on this thread, the workers only ever touch
+  // their own instance. Images are shared by every instance of the file, and
+  // each thread draws them with a texture of its own.
+  std::vector<SequenceWorker> workers(threadCount);
+  for (unsigned int i = 0; i < threadCount; i++)
+  {
+    SequenceWorker& worker = workers[i];
+    if (i == 0)
+    {
+      worker.artboard = std::move(artboard);
+      worker.scene = std::move(scene);
+    }
+    else if (!instantiateArtboard(file, options, worker.artboard, worker.scene, error))
+    {
+      return false;
+    }
+
+    worker.firstFrame = static_cast<int>(static_cast<int64_t>(frameCount) * i / threadCount);
+    worker.lastFrame = static_cast<int>(static_cast<int64_t>(frameCount) * (i + 1) / threadCount);
+  }
+
+  const bool spriteSheet = !sequence.spriteSheetPath.empty();
+  const int columns = spriteSheet ? static_cast<int>(std::ceil(std::sqrt(static_cast<float>(frameCount)))) : 1;
+  const int rows = spriteSheet ? (frameCount + columns - 1) / columns : 1;
+
+  plutovg_surface_t* atlas = nullptr;
+  if (spriteSheet)
+  {
+    // plutovg sizes surfaces with int arithmetic: the atlas is bounded well
+    // within it, and cell offsets are computed in size_t.
+    const int64_t atlasWidth = static_cast<int64_t>(width) * columns;
+    const int64_t atlasHeight = static_cast<int64_t>(height) * rows;
+    if (atlasWidth > kMaxAtlasPixels || atlasHeight > kMaxAtlasPixels || atlasWidth * atlasHeight > kMaxAtlasPixels)
+    {
+      error = "the sprite sheet would exceed " + std::to_string(kMaxAtlasPixels) + " pixels";
+      return false;
+    }
+
+    atlas = plutovg_surface_create(width * columns, height * rows);
+    if (atlas == nullptr)
+    {
+      error = "failed to allocate the sprite sheet";
+      return false;
+    }
+  }
+
+  VideoWriter videoWriter;
+  if (video && !videoWriter.open(sequence.videoPath, sequence.videoFormat, width, height, sequence.fps))
+  {
+    error = "failed to open the video output";
+    return false;
+  }
+
+  const std::string& animatedPath = sequence.animatedPath;
+  const bool gif = animatedPath.size() >= 4 && (animatedPath.compare(animatedPath.size() - 4, 4, ".gif") == 0 || animatedPath.compare(animatedPath.size() - 4, 4, ".GIF") == 0);
+  rive::PlutoVG_AnimationEncoder encoder(gif ? rive::PlutoVG_AnimationFormat::gif : rive::PlutoVG_AnimationFormat::apng, sequence.fps);
+
+  // sourceFrame[i] is i for rasterized frames. With dedupe, frames drawing the
+  // same stream as their predecessor are not rasterized and point back to it.
+  std::vector<int> sourceFrame(frameCount);
+  std::atomic<bool> failed{false};
+  auto work = [&](SequenceWorker& worker)
+  {
+    rive::PlutoVG_HashRenderer hasher;
+    auto hashFrame = [&]()
+    {
+      hasher.reset();
+      drawArtboard(hasher, *worker.artboard, width, height);
+      return hasher.hash();
+    };
+
+    uint64_t previousHash = 0;
+    bool hasPrevious = false;
+
+    worker.scene->advanceAndApply(sequence.start);
+    for (int frame = 0; frame < worker.firstFrame; frame++)
+    {
+      // The last frame of the previous chunk is needed to dedupe the first
+      // frame of this one.
+      if (sequence.dedupe && frame + 1 == worker.firstFrame)
+      {
+        previousHash = hashFrame();
+        hasPrevious = true;
+      }
+      worker.scene->advanceAndApply(frameDuration);
+    }
+
+    plutovg_surface_t* surface = spriteSheet || video ? nullptr : plutovg_surface_create(width, height);
+    std::unique_ptr<rive::PlutoVG_Renderer> frameRenderer;
+    if (surface != nullptr)
+      frameRenderer = std::make_unique<rive::PlutoVG_Renderer>(surface);
+    else if (!spriteSheet && !video)
+      failed = true;
+    std::vector<uint8_t> bytes;
+    rive::PlutoVG_IRect previousDamage;
+
+    for (int frame = worker.firstFrame; frame < worker.lastFrame && !failed; frame++)
+    {
+      if (frame > worker.firstFrame)
+        worker.scene->advanceAndApply(frameDuration);
+
+      sourceFrame[frame] = frame;
+      if (sequence.dedupe)
+      {
+        const uint64_t hash = hashFrame();
+        const bool duplicate = hasPrevious && hash == previousHash;
+        previousHash = hash;
+        hasPrevious = true;
+        if (duplicate)
+        {
+          if (video && !videoWriter.repeatFrame())
+            failed = true;
+          else if (animated)
+            encoder.repeatFrame();
+          sourceFrame[frame] = frame - 1;
+          continue;
+        }
+      }
+
+      if (spriteSheet)
+      {
+        // Frames are drawn in place into their (still cleared) atlas cell.
+        const int column = frame % columns, row = frame / columns;
+        uint8_t* cell = plutovg_surface_get_data(atlas) + static_cast<size_t>(plutovg_surface_get_stride(atlas)) * height * row + static_cast<size_t>(width) * 4 * column;
+        plutovg_surface_t* target = plutovg_surface_create_for_data(cell, width, height, plutovg_surface_get_stride(atlas));
+
+        rive::PlutoVG_Renderer renderer(target);
+        drawArtboard(renderer, *worker.artboard, width, height);
+        plutovg_surface_destroy(target);
+        continue;
+      }
+
+      if (animated)
+      {
+        // Pixels outside of what both a frame and the previous one drew are
+        // transparent in both, the encoder only compares the rest.
+        frameRenderer->clear();
+        drawArtboard(*frameRenderer, *worker.artboard, width, height);
+        const rive::PlutoVG_IRect damage = frameRenderer->damage().united(previousDamage);
+        previousDamage = frameRenderer->damage();
+        if (!encoder.addFrame(*frameRenderer, &damage))
+          failed = true;
+        continue;
+      }
+
+      if (video)
+      {
+        rive::PlutoVG_Renderer* renderer = videoWriter.acquireFrame();
+        if (renderer == nullptr)
+        {
+          failed = true;
+          continue;
+        }
+
+        drawArtboard(*renderer, *worker.artboard, width, height);
+        videoWriter.submitFrame();
+        continue;
+      }
+
+      // Only the area drawn by the previous frame needs to be cleared.
+      frameRenderer->clear();
+      drawArtboard(*frameRenderer, *worker.artboard, width, height);
+      if (!encodeImage(*frameRenderer, options.format, bytes) || !writeFile(frameFileName(sequence.framesPrefix, frame, options.format), bytes))
+        failed = true;
+    }
+
+    if (surface != nullptr)
+      plutovg_surface_destroy(surface);
+  };
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < threadCount; i++)
+    threads.emplace_back(work, std::ref(workers[i]));
+  work(workers[0]);
+  for (auto& thread : threads)
+    thread.join();
+
+  if (video)
+  {
+    if (!videoWriter.close())
+    {
+      error = "failed to write the video stream";
+      return false;
+    }
+    return true;
+  }
+
+  if (failed)
+  {
+    if (atlas != nullptr)
+      plutovg_surface_destroy(atlas);
+    error = animated ? "failed to encode the animated image" : "failed to write frames";
+    return false;
+  }
+
+  // Duplicates reference their predecessor, which may be a duplicate itself.
+  int uniqueCount = 0;
+  std::vector<int> cell(frameCount);
+  for (int frame = 0; frame < frameCount; frame++)
+  {
+    if (sourceFrame[frame] != frame)
+      sourceFrame[frame] = sourceFrame[sourceFrame[frame]];
+    else
+      cell[frame] = uniqueCount++;
+  }
+
+  if (animated)
+  {
+    if (!writeFile(animatedPath, encoder.finish()))
+    {
+      error = "failed to write the animated image";
+      return false;
+    }
+    return true;
+  }
+
+  if (!spriteSheet)
+  {
+    if (!sequence.dedupe)
+      return true;
+
+    std::string json = "{\n  \"frames\": [\n";
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+      const std::string name = frameFileName(sequence.framesPrefix, sourceFrame[frame], options.format);
+      const size_t slash = name.find_last_of("\\/");
+      json += "    {\"index\": " + std::to_string(frame) + ", \"file\": \"" + jsonEscape(slash == std::string::npos ? name : name.substr(slash + 1)) + "\"";
+      if (sourceFrame[frame] != frame)
+        json += ", \"duplicateOf\": " + std::to_string(sourceFrame[frame]);
+      json += frame + 1 < frameCount ? "},\n" : "}\n";
+    }
+    json += "  ]\n}\n";
+
+    if (!writeFile(sequence.framesPrefix + ".json", std::vector<uint8_t>(json.begin(), json.end())))
+    {
+      error = "failed to write the frame map";
+      return false;
+    }
+    return true;
+  }
+
+  // Pack the rasterized frames at the front of the atlas, cells only ever move
+  // backwards so a forward pass never overwrites a cell that is still needed.
+  uint8_t* atlasData = plutovg_surface_get_data(atlas);
+  const int atlasStride = plutovg_surface_get_stride(atlas);
+  auto cellData = [&](int index)
+  {
+    return atlasData + static_cast<size_t>(atlasStride) * height * (index / columns) + static_cast<size_t>(width) * 4 * (index % columns);
+  };
+
+  const int usedRows = (uniqueCount + columns - 1) / columns;
+  if (uniqueCount < frameCount)
+  {
+    for (int frame = 0; frame < frameCount; frame++)
+    {
+      if (sourceFrame[frame] != frame || cell[frame] == frame)
+        continue;
+
+      for (int y = 0; y < height; y++)
+        memcpy(cellData(cell[frame]) + static_cast<size_t>(atlasStride) * y, cellData(frame) + static_cast<size_t>(atlasStride) * y, width * 4);
+    }
+
+    for (int index = uniqueCount; index < usedRows * columns; index++)
+    {
+      for (int y = 0; y < height; y++)
+        memset(cellData(index) + static_cast<size_t>(atlasStride) * y, 0, width * 4);
+    }
+  }
+
+  std::vector<uint8_t> bytes;
+  plutovg_surface_t* packed = plutovg_surface_create_for_data(atlasData, width * columns, height * usedRows, atlasStride);
+  bool encoded;
+  {
+    rive::PlutoVG_Renderer atlasRenderer(packed);
+    encoded = encodeImage(atlasRenderer, options.format, bytes);
+  }
+  plutovg_surface_destroy(packed);
+  plutovg_surface_destroy(atlas);
+  if (!encoded || !writeFile(sequence.spriteSheetPath, bytes))
+  {
+    error = "failed to write the sprite sheet";
+    return false;
+  }
+
+  const size_t slash = sequence.spriteSheetPath.find_last_of("\\/");
+  const std::string imageName = slash == std::string::npos ? sequence.spriteSheetPath : sequence.spriteSheetPath.substr(slash + 1);
+
+  std::string json = "{\n";
+  json += "  \"image\": \"" + jsonEscape(imageName) + "\",\n";
+  json += "  \"frameWidth\": " + std::to_string(width) + ",\n";
+  json += "  \"frameHeight\": " + std::to_string(height) + ",\n";
+  json += "  \"columns\": " + std::to_string(columns) + ",\n";
+  json += "  \"rows\": " + std::to_string(usedRows) + ",\n";
+  json += "  \"fps\": " + std::to_string(sequence.fps) + ",\n";
+  json += "  \"frames\": [\n";
+  for (int frame = 0; frame < frameCount; frame++)
+  {
+    const int index = cell[sourceFrame[frame]];
+
+    char entry[192];
+    snprintf(entry, sizeof(entry), "    {\"index\": %d, \"time\": %.6f, \"x\": %d, \"y\": %d, \"w\": %d, \"h\": %d",
+      frame,
+      sequence.start + frame * frameDuration,
+      index % columns * width,
+      index / columns * height,
+      width,
+      height);
+    json += entry;
+    if (sourceFrame[frame] != frame)
+      json += ", \"duplicateOf\": " + std::to_string(sourceFrame[frame]);
+    json += frame + 1 < frameCount ? "},\n" : "}\n";
+  }
+  json += "  ]\n}\n";
+
+  const size_t dot = sequence.spriteSheetPath.find_last_of('.');
+  const std::string jsonPath = (dot != std::string::npos && (slash == std::string::npos || dot > slash) ? sequence.spriteSheetPath.substr(0, dot) : sequence.spriteSheetPath) + ".json";
+  if (!writeFile(jsonPath, std::vector<uint8_t>(json.begin(), json.end())))
+  {
+    error = "failed to write the frame map";
+    return false;
+  }
+
+  return true;
+}
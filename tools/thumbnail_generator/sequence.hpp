@@ -0,0 +1,54 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _THUMBNAIL_GENERATOR_SEQUENCE_HPP_
+#define _THUMBNAIL_GENERATOR_SEQUENCE_HPP_
+
+#include "thumbnail.hpp"
+#include "video_writer.hpp"
+
+#include <string>
+
+struct SequenceOptions
+{
+  float fps{30.0f};
+  float start{0.0f};
+  // Defaults to the duration of the animation when negative.
+  float end{-1.0f};
+  // Defaults to the number of hardware threads when zero.
+  unsigned int threads{0};
+  // Skips rasterizing frames whose draw stream matches the previous frame.
+  bool dedupe{false};
+  // Numbered frames are written as <framesPrefix>_0000.<ext>.
+  std::string framesPrefix;
+  // The atlas is written to spriteSheetPath, its frame map next to it as .json.
+  std::string spriteSheetPath;
+  // An animated GIF when the path ends with .gif, an animated PNG otherwise.
+  std::string animatedPath;
+  // A YUV stream written to a file, a fifo or stdout ("-"), rendered in order
+  // on a single thread.
+  std::string videoPath;
+  VideoFormat videoFormat{VideoFormat::y4m};
+};
+
+bool setSequenceOption(SequenceOptions& options, const std::string& key, const std::string& value);
+
+// Renders the animation or state machine selected by `options` over
+// [start, end) at `fps`, to numbered frames, a sprite sheet, an animated
+// image or a video stream.
+bool renderSequence(rive::File& file, const ThumbnailOptions& options, const SequenceOptions& sequence, std::string& error);
+
+#endif
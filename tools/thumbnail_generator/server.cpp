@@ -0,0 +1,474 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "server.hpp"
+#include "thumbnail.hpp"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static const size_t kMaxPayloadSize = size_t(1) << 30;
+
+// Identifies the version of a file on disk a cached import was made from.
+// Bytes payloads have a zero stamp.
+struct FileStamp
+{
+  int64_t modifiedNs{0};
+  int64_t size{0};
+  uint64_t inode{0};
+
+  bool operator==(const FileStamp& other) const
+  {
+    return modifiedNs == other.modifiedNs && size == other.size && inode == other.inode;
+  }
+  bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+static FileStamp fileStamp(const struct stat& info)
+{
+  FileStamp stamp;
+#if defined(__APPLE__)
+  stamp.modifiedNs = static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+  stamp.modifiedNs = static_cast<int64_t>(info.st_mtime) * 1000000000;
+#else
+  stamp.modifiedNs = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+  stamp.size = static_cast<int64_t>(info.st_size);
+  stamp.inode = static_cast<uint64_t>(info.st_ino);
+  return stamp;
+}
+
+class FileCache
+{
+public:
+  FileCache(size_t capacity, rive::Factory& factory)
+    : m_capacity(capacity > 0 ? capacity : 1)
+    , m_factory(factory)
+  {
+  }
+
+  rive::File* fromPath(const std::string& path, std::string& error)
+  {
+    // The stamp is taken from the file that is read, a file replaced in
+    // between cannot be cached under the stamp of another.
+    FILE* fp = fopen(path.c_str(), "rb");
+    struct stat info;
+    if (fp == nullptr || fstat(fileno(fp), &info) != 0)
+    {
+      if (fp != nullptr)
+        fclose(fp);
+      error = "failed to open rive file";
+      return nullptr;
+    }
+
+    // A changed modification time, size or inode invalidates the cached
+    // import.
+    const FileStamp stamp = fileStamp(info);
+    const std::string key = "path:" + path;
+    if (rive::File* file = find(key, stamp))
+    {
+      fclose(fp);
+      return file;
+    }
+    if (static_cast<uint64_t>(info.st_size) > kMaxPayloadSize)
+    {
+      fclose(fp);
+      error = "rive file too large";
+      return nullptr;
+    }
+
+    // Files are read rather than mapped: a file truncated while it is being
+    // imported would fault the server on a mapping, a read only comes back
+    // short, and the import fails.
+    const bool read = readFile(fp, static_cast<size_t>(info.st_size));
+    fclose(fp);
+    if (!read)
+    {
+      error = "failed to read rive file";
+      return nullptr;
+    }
+
+    return insert(key, stamp, rive::toSpan(m_readBuffer), error);
+  }
+
+  rive::File* fromBytes(const std::vector<uint8_t>& bytes, std::string& error)
+  {
+    // FNV-1a, the payload size is part of the key to make collisions even less likely.
+    uint64_t hash = 14695981039346656037ull;
+    for (uint8_t byte : bytes)
+    {
+      hash ^= byte;
+      hash *= 1099511628211ull;
+    }
+
+    const std::string key = "bytes:" + std::to_string(hash) + ":" + std::to_string(bytes.size());
+    if (rive::File* file = find(key, {}))
+      return file;
+
+    return insert(key, {}, rive::toSpan(bytes), error);
+  }
+
+private:
+  struct Entry
+  {
+    std::string key;
+    FileStamp stamp;
+    std::unique_ptr<rive::File> file;
+  };
+
+  // Reads the rest of the file into m_readBuffer, whose capacity is kept for
+  // the next files.
+  bool readFile(FILE* fp, size_t sizeHint)
+  {
+    m_readBuffer.clear();
+    m_readBuffer.reserve(sizeHint);
+    uint8_t chunk[64 * 1024];
+    size_t count;
+    while ((count = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+    {
+      if (m_readBuffer.size() + count > kMaxPayloadSize)
+        return false;
+      m_readBuffer.insert(m_readBuffer.end(), chunk, chunk + count);
+    }
+    return ferror(fp) == 0;
+  }
+
+  rive::File* find(const std::string& key, const FileStamp& stamp)
+  {
+    auto it = m_index.find(key);
+    if (it == m_index.end())
+      return nullptr;
+
+    if (it->second->stamp != stamp)
+    {
+      m_entries.erase(it->second);
+      m_index.erase(it);
+      return nullptr;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return m_entries.front().file.get();
+  }
+
+  rive::File* insert(const std::string& key, const FileStamp& stamp, rive::Span<const uint8_t> bytes, std::string& error)
+  {
+    auto file = rive::File::import(bytes, &m_factory);
+    if (!file)
+    {
+      error = "failed to import rive file";
+      return nullptr;
+    }
+
+    while (m_entries.size() >= m_capacity)
+    {
+      m_index.erase(m_entries.back().key);
+      m_entries.pop_back();
+    }
+
+    m_entries.push_front(Entry{key, stamp, std::move(file)});
+    m_index[key] = m_entries.begin();
+    return m_entries.front().file.get();
+  }
+
+  size_t m_capacity;
+  rive::Factory& m_factory;
+  std::list<Entry> m_entries;
+  std::unordered_map<std::string, std::list<Entry>::iterator> m_index;
+  std::vector<uint8_t> m_readBuffer;
+};
+
+class ThumbnailServer
+{
+public:
+  ThumbnailServer(size_t cacheCapacity, rive::Factory& factory)
+    : m_cache(cacheCapacity, factory)
+  {
+  }
+
+  bool quit() const { return m_quit; }
+
+  // Handles requests from `in` until it is exhausted, a `quit` request is read
+  // or a payload size cannot be read.
+  void serve(FILE* in, FILE* out)
+  {
+    std::string line;
+    m_lostSync = false;
+    while (!m_quit && !m_lostSync && readLine(in, line))
+    {
+      if (line.empty())
+        continue;
+
+      std::vector<std::vector<uint8_t>> outputs;
+      std::string error;
+      if (!handle(line, in, outputs, error))
+      {
+        if (m_quit)
+          break;
+
+        fprintf(out, "error %s\n", error.c_str());
+      }
+      else
+      {
+        for (const auto& output : outputs)
+        {
+          fprintf(out, "ok %zu\n", output.size());
+          fwrite(output.data(), 1, output.size(), out);
+        }
+      }
+
+      if (fflush(out) != 0)
+        break;
+    }
+  }
+
+private:
+  static bool readLine(FILE* in, std::string& line)
+  {
+    line.clear();
+
+    int c;
+    while ((c = fgetc(in)) != EOF)
+    {
+      if (c == '\n')
+        break;
+      if (c != '\r')
+        line.push_back(static_cast<char>(c));
+    }
+
+    return c != EOF || !line.empty();
+  }
+
+  bool handle(const std::string& line, FILE* in, std::vector<std::vector<uint8_t>>& outputs, std::string& error)
+  {
+    std::vector<std::string> tokens;
+    for (size_t start = 0; start < line.size();)
+    {
+      const size_t end = std::min(line.find(' ', start), line.size());
+      if (end > start)
+        tokens.push_back(line.substr(start, end - start));
+      start = end + 1;
+    }
+
+    if (tokens.empty())
+    {
+      error = "empty request";
+      return false;
+    }
+
+    if (tokens[0] == "quit")
+    {
+      m_quit = true;
+      return false;
+    }
+
+    if (tokens[0] != "render")
+    {
+      error = "unknown request";
+      return false;
+    }
+
+    ThumbnailOptions options;
+    std::string path;
+    size_t payloadSize = 0;
+    bool hasPayload = false;
+    bool validSize = true;
+    bool valid = true;
+    for (size_t i = 1; i < tokens.size(); i++)
+    {
+      const size_t separator = tokens[i].find('=');
+      if (separator == std::string::npos)
+      {
+        valid = false;
+        continue;
+      }
+
+      const std::string key = tokens[i].substr(0, separator);
+      const std::string value = tokens[i].substr(separator + 1);
+      if (key == "path")
+      {
+        path = value;
+      }
+      else if (key == "bytes")
+      {
+        char* end = nullptr;
+        payloadSize = strtoull(value.c_str(), &end, 10);
+        hasPayload = true;
+        validSize = validSize && isdigit(static_cast<unsigned char>(value[0])) && *end == '\0';
+      }
+      else if (!setThumbnailOption(options, key, value))
+      {
+        valid = false;
+      }
+    }
+
+    // The payload has to be consumed even for invalid requests to keep the
+    // stream in sync. Without a readable size, the next request cannot be
+    // found and serving the stream stops.
+    if (!validSize)
+    {
+      error = "invalid payload size";
+      m_lostSync = true;
+      return false;
+    }
+
+    if (hasPayload && payloadSize > kMaxPayloadSize)
+    {
+      uint8_t skipped[65536];
+      for (size_t left = payloadSize; left > 0;)
+      {
+        const size_t chunk = std::min(left, sizeof(skipped));
+        if (fread(skipped, 1, chunk, in) != chunk)
+        {
+          error = "truncated payload";
+          m_lostSync = true;
+          return false;
+        }
+        left -= chunk;
+      }
+
+      error = "payload too large";
+      return false;
+    }
+
+    std::vector<uint8_t> payload;
+    if (hasPayload)
+    {
+      payload.resize(payloadSize);
+      if (fread(payload.data(), 1, payloadSize, in) != payloadSize)
+      {
+        error = "truncated payload";
+        m_lostSync = true;
+        return false;
+      }
+    }
+
+    if (!valid || hasPayload == !path.empty())
+    {
+      error = "invalid request";
+      return false;
+    }
+
+    rive::File* file = hasPayload ? m_cache.fromBytes(payload, error) : m_cache.fromPath(path, error);
+    if (file == nullptr)
+      return false;
+
+    return renderThumbnails(*file, options, outputs, error, &m_surfaces);
+  }
+
+  FileCache m_cache;
+  // Render targets are recycled between requests of the same sizes.
+  rive::PlutoVG_SurfacePool m_surfaces;
+  bool m_quit{false};
+  // Set when a request's payload could not be skipped, see serve().
+  bool m_lostSync{false};
+};
+
+#ifndef _WIN32
+static int serveSocket(const char* path, ThumbnailServer& server)
+{
+  sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(address.sun_path))
+  {
+    fprintf(stderr, "Socket path is too long.\n");
+    return 1;
+  }
+  strcpy(address.sun_path, path);
+
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0)
+  {
+    fprintf(stderr, "Failed to create socket.\n");
+    return 1;
+  }
+
+  unlink(path);
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 16) != 0)
+  {
+    fprintf(stderr, "Failed to listen on %s.\n", path);
+    close(listener);
+    return 1;
+  }
+
+  // A client hanging up mid-reply must not take the server down.
+  signal(SIGPIPE, SIG_IGN);
+
+  while (!server.quit())
+  {
+    const int client = accept(listener, nullptr, nullptr);
+    if (client < 0)
+      continue;
+
+    FILE* in = fdopen(client, "rb");
+    FILE* out = fdopen(dup(client), "wb");
+    if (in != nullptr && out != nullptr)
+      server.serve(in, out);
+
+    if (in != nullptr)
+      fclose(in);
+    else
+      close(client);
+    if (out != nullptr)
+      fclose(out);
+  }
+
+  close(listener);
+  unlink(path);
+  return 0;
+}
+#endif
+
+int runServer(const char* endpoint, size_t cacheCapacity, rive::Factory& factory)
+{
+  ThumbnailServer server(cacheCapacity, factory);
+
+  if (strcmp(endpoint, "-") == 0)
+  {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    server.serve(stdin, stdout);
+    return 0;
+  }
+
+#ifdef _WIN32
+  fprintf(stderr, "Unix domain sockets are not supported on this platform, use --serve -.\n");
+  return 1;
+#else
+  return serveSocket(endpoint, server);
+#endif
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _THUMBNAIL_GENERATOR_SERVER_HPP_
+#define _THUMBNAIL_GENERATOR_SERVER_HPP_
+
+#include <rive/factory.hpp>
+
+#include <cstddef>
+
+// Serves render requests until a `quit` request is received. `endpoint` is the
+// path of a Unix domain socket to listen on, or "-" to read framed requests
+// from stdin and write the replies to stdout.
+//
+// Each request is a single header line, optionally followed by a payload:
+//
+//   render path=<file.riv> [artboard=..] [animation=..|statemachine=..]
+//          [time=..] [width=..] [height=..] [size=..] [sizes=64,128,..]
+//          [format=png|qoi|raw]
+//   render bytes=<n> [options...]\n<n bytes of .riv data>
+//   quit
+//
+// and is answered with `ok <n>\n<n bytes>` per rendered size (in the order of
+// `sizes`) or a single `error <message>\n`. Imported files (along with the
+// images decoded during their import) are kept in an LRU cache of
+// `cacheCapacity` entries.
+int runServer(const char* endpoint, size_t cacheCapacity, rive::Factory& factory);
+
+#endif
@@ -0,0 +1,257 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thumbnail.hpp"
+
+#include <rive/math/aabb.hpp>
+
+#include <plutovg.h>
+
+#include <plutonriver/renderer.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static bool parseInt(const std::string& value, int& result)
+{
+  char* end = nullptr;
+  const long parsed = strtol(value.c_str(), &end, 10);
+  if (end == value.c_str() || *end != '\0' || parsed <= 0 || parsed > 16384)
+    return false;
+
+  result = static_cast<int>(parsed);
+  return true;
+}
+
+static bool parseFloat(const std::string& value, float& result)
+{
+  char* end = nullptr;
+  const float parsed = strtof(value.c_str(), &end);
+  if (end == value.c_str() || *end != '\0' || parsed < 0.0f)
+    return false;
+
+  result = parsed;
+  return true;
+}
+
+bool setThumbnailOption(ThumbnailOptions& options, const std::string& key, const std::string& value)
+{
+  if (key == "artboard")
+  {
+    options.artboard = value;
+    return true;
+  }
+  if (key == "animation")
+  {
+    options.animation = value;
+    return true;
+  }
+  if (key == "statemachine")
+  {
+    options.stateMachine = value;
+    return true;
+  }
+  if (key == "time")
+    return parseFloat(value, options.time);
+  if (key == "width")
+    return parseInt(value, options.width);
+  if (key == "height")
+    return parseInt(value, options.height);
+  if (key == "size")
+  {
+    if (!parseInt(value, options.width))
+      return false;
+
+    options.height = options.width;
+    return true;
+  }
+  if (key == "sizes")
+  {
+    options.sizes.clear();
+    for (size_t start = 0; start <= value.size();)
+    {
+      const size_t end = std::min(value.find(',', start), value.size());
+      int size;
+      if (!parseInt(value.substr(start, end - start), size))
+        return false;
+
+      options.sizes.push_back(size);
+      start = end + 1;
+    }
+    return true;
+  }
+  if (key == "format")
+  {
+    if (value == "png")
+      options.format = ImageFormat::png;
+    else if (value == "qoi")
+      options.format = ImageFormat::qoi;
+    else if (value == "raw")
+      options.format = ImageFormat::raw;
+    else
+      return false;
+
+    return true;
+  }
+
+  return false;
+}
+
+const char* imageFormatExtension(ImageFormat format)
+{
+  switch (format)
+  {
+    case ImageFormat::qoi:
+      return ".qoi";
+    case ImageFormat::raw:
+      return ".raw";
+    default:
+    case ImageFormat::png:
+      return ".png";
+  }
+}
+
+bool instantiateArtboard(rive::File& file,
+  const ThumbnailOptions& options,
+  std::unique_ptr<rive::ArtboardInstance>& artboard,
+  std::unique_ptr<rive::Scene>& scene,
+  std::string& error)
+{
+  artboard = options.artboard.empty() ? file.artboardDefault() : file.artboardNamed(options.artboard);
+  if (!artboard)
+  {
+    error = "artboard not found";
+    return false;
+  }
+
+  scene = nullptr;
+  if (!options.animation.empty())
+  {
+    scene = artboard->animationNamed(options.animation);
+    if (!scene)
+    {
+      error = "animation not found";
+      return false;
+    }
+  }
+  else if (!options.stateMachine.empty())
+  {
+    scene = artboard->stateMachineNamed(options.stateMachine);
+    if (!scene)
+    {
+      error = "state machine not found";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void drawArtboard(rive::Renderer& renderer, rive::ArtboardInstance& artboard, int width, int height)
+{
+  renderer.save();
+  renderer.align(rive::Fit::cover, rive::Alignment::center,
+    rive::AABB(0, 0, width, height), artboard.bounds());
+  artboard.draw(&renderer);
+  renderer.restore();
+}
+
+bool encodeImage(rive::PlutoVG_Renderer& renderer, ImageFormat format, std::vector<uint8_t>& output)
+{
+  switch (format)
+  {
+    case ImageFormat::png:
+      output = renderer.encodePNG();
+      break;
+
+    case ImageFormat::qoi:
+      output = renderer.encodeQOI();
+      break;
+
+    case ImageFormat::raw:
+    {
+      const uint8_t* data = renderer.data();
+      const int rowSize = renderer.width() * 4;
+      output.resize(static_cast<size_t>(rowSize) * renderer.height());
+      for (int y = 0; y < renderer.height(); y++)
+        memcpy(output.data() + static_cast<size_t>(rowSize) * y, data + renderer.stride() * y, rowSize);
+      break;
+    }
+  }
+
+  return !output.empty();
+}
+
+bool renderThumbnails(rive::File& file,
+  const ThumbnailOptions& options,
+  std::vector<std::vector<uint8_t>>& outputs,
+  std::string& error,
+  rive::PlutoVG_SurfacePool* pool)
+{
+  std::unique_ptr<rive::ArtboardInstance> artboard;
+  std::unique_ptr<rive::Scene> scene;
+  if (!instantiateArtboard(file, options, artboard, scene, error))
+    return false;
+
+  if (scene)
+    scene->advanceAndApply(options.time);
+  else
+    artboard->advance(0.0f);
+
+  // Every size is drawn from the same advanced artboard: the paths are only
+  // rebuilt once and each extra size only pays for its own rasterization.
+  std::vector<std::pair<int, int>> sizes;
+  for (int size : options.sizes)
+    sizes.emplace_back(size, size);
+  if (sizes.empty())
+    sizes.emplace_back(options.width, options.height);
+
+  outputs.clear();
+  outputs.resize(sizes.size());
+  bool allocated = true;
+  for (size_t i = 0; i < sizes.size(); i++)
+  {
+    plutovg_surface_t* surface = pool != nullptr ? pool->acquireSurface(sizes[i].first, sizes[i].second) : plutovg_surface_create(sizes[i].first, sizes[i].second);
+    if (surface == nullptr)
+    {
+      error = "failed to allocate a " + std::to_string(sizes[i].first) + "x" + std::to_string(sizes[i].second) + " surface";
+      allocated = false;
+      continue;
+    }
+
+    bool encoded;
+    rive::PlutoVG_IRect damage;
+    {
+      rive::PlutoVG_Renderer renderer(surface);
+      drawArtboard(renderer, *artboard, sizes[i].first, sizes[i].second);
+      encoded = encodeImage(renderer, options.format, outputs[i]);
+      damage = renderer.damage();
+    }
+
+    // Only what was drawn is cleared when the pool hands the buffer out again.
+    if (pool != nullptr)
+      pool->releaseSurface(surface, &damage);
+    else
+      plutovg_surface_destroy(surface);
+
+    if (!encoded)
+    {
+      error = "failed to encode image";
+      return false;
+    }
+  }
+
+  return allocated;
+}
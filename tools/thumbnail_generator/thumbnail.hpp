@@ -0,0 +1,77 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _THUMBNAIL_GENERATOR_THUMBNAIL_HPP_
+#define _THUMBNAIL_GENERATOR_THUMBNAIL_HPP_
+
+#include <rive/file.hpp>
+
+#include <plutonriver/renderer.hpp>
+#include <plutonriver/surface_pool.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class ImageFormat
+{
+  png,
+  qoi,
+  raw,
+};
+
+struct ThumbnailOptions
+{
+  std::string artboard;
+  std::string animation;
+  std::string stateMachine;
+  float time{0.0f};
+  int width{1024};
+  int height{1024};
+  // Square sizes rendered from a single advance, overrides width and height.
+  std::vector<int> sizes;
+  ImageFormat format{ImageFormat::png};
+};
+
+// Applies a single `key=value` option, shared by the command line and the
+// server request parser. Returns false on unknown keys or invalid values.
+bool setThumbnailOption(ThumbnailOptions& options, const std::string& key, const std::string& value);
+
+const char* imageFormatExtension(ImageFormat format);
+
+// Instantiates the artboard selected by `options`, along with its animation or
+// state machine when one is requested (`scene` is left empty otherwise).
+bool instantiateArtboard(rive::File& file,
+  const ThumbnailOptions& options,
+  std::unique_ptr<rive::ArtboardInstance>& artboard,
+  std::unique_ptr<rive::Scene>& scene,
+  std::string& error);
+
+// Draws the artboard covering a width x height target.
+void drawArtboard(rive::Renderer& renderer, rive::ArtboardInstance& artboard, int width, int height);
+
+bool encodeImage(rive::PlutoVG_Renderer& renderer, ImageFormat format, std::vector<uint8_t>& output);
+
+// Renders one image per requested size, in the order of `options.sizes`. The
+// render targets come from `pool` when one is given. Sizes whose target
+// cannot be allocated are skipped, left empty, and fail the call.
+bool renderThumbnails(rive::File& file,
+  const ThumbnailOptions& options,
+  std::vector<std::vector<uint8_t>>& outputs,
+  std::string& error,
+  rive::PlutoVG_SurfacePool* pool = nullptr);
+
+#endif
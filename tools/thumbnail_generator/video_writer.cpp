@@ -0,0 +1,185 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "video_writer.hpp"
+
+#include <cmath>
+#include <cstring>
+
+static int greatestCommonDivisor(int a, int b)
+{
+  while (b != 0)
+  {
+    const int remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+  return a;
+}
+
+VideoWriter::~VideoWriter()
+{
+  close();
+}
+
+bool VideoWriter::open(const std::string& path, VideoFormat format, int width, int height, float fps)
+{
+  m_output = path == "-" ? stdout : fopen(path.c_str(), "wb");
+  if (m_output == nullptr)
+    return false;
+
+  m_format = format;
+  m_width = width;
+  m_height = height;
+  m_frame.resize(rive::PlutoVG_YUVConverter::frameSize(width, height));
+  for (int i = 0; i < 2; i++)
+  {
+    m_surfaces[i] = plutovg_surface_create(width, height);
+    m_renderers[i] = std::make_unique<rive::PlutoVG_Renderer>(m_surfaces[i]);
+  }
+
+  if (format == VideoFormat::y4m)
+  {
+    // The frame rate as a ratio of integers, in thousandths of a frame.
+    const int numerator = static_cast<int>(std::lround(fps * 1000.0f)), denominator = 1000;
+    const int divisor = greatestCommonDivisor(numerator, denominator);
+
+    if (fprintf(m_output, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", width, height, numerator / divisor, denominator / divisor) < 0)
+      m_failed = true;
+  }
+
+  m_thread = std::thread(&VideoWriter::run, this);
+  return true;
+}
+
+rive::PlutoVG_Renderer* VideoWriter::acquireFrame()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_condition.wait(lock, [this]() { return m_failed || !m_busy[m_next]; });
+  if (m_failed)
+    return nullptr;
+
+  rive::PlutoVG_Renderer* renderer = m_renderers[m_next].get();
+  renderer->clear();
+  return renderer;
+}
+
+void VideoWriter::submitFrame()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_busy[m_next] = true;
+    m_queue.push_back(m_next);
+    m_next ^= 1;
+  }
+  m_condition.notify_all();
+}
+
+bool VideoWriter::repeatFrame()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_failed)
+      return false;
+    m_queue.push_back(-1);
+  }
+  m_condition.notify_all();
+  return true;
+}
+
+void VideoWriter::run()
+{
+  for (;;)
+  {
+    int index;
+    bool failed;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [this]() { return m_closing || !m_queue.empty(); });
+      if (m_queue.empty())
+        return;
+
+      index = m_queue.front();
+      m_queue.pop_front();
+      failed = m_failed;
+    }
+
+    // Frames still queued after a failed write are dropped.
+    if (failed)
+    {
+      if (index >= 0)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy[index] = false;
+      }
+      continue;
+    }
+
+    // The surface is released as soon as it is converted, so the next frame
+    // renders while this one is being written.
+    if (index >= 0)
+    {
+      plutovg_surface_t* surface = m_surfaces[index];
+      rive::PlutoVG_YUVConverter::convert(m_format == VideoFormat::nv12 ? rive::PlutoVG_YUVLayout::nv12 : rive::PlutoVG_YUVLayout::i420,
+        plutovg_surface_get_data(surface),
+        m_width,
+        m_height,
+        plutovg_surface_get_stride(surface),
+        m_frame.data());
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_busy[index] = false;
+      }
+      m_condition.notify_all();
+    }
+
+    bool written = true;
+    if (m_format == VideoFormat::y4m)
+      written = fputs("FRAME\n", m_output) >= 0;
+    written = written && fwrite(m_frame.data(), 1, m_frame.size(), m_output) == m_frame.size();
+    if (!written)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_failed = true;
+      }
+      m_condition.notify_all();
+    }
+  }
+}
+
+bool VideoWriter::close()
+{
+  if (m_output == nullptr)
+    return !m_failed;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_closing = true;
+  }
+  m_condition.notify_all();
+  m_thread.join();
+
+  if (m_output == stdout ? fflush(m_output) != 0 : fclose(m_output) != 0)
+    m_failed = true;
+  m_output = nullptr;
+
+  for (int i = 0; i < 2; i++)
+  {
+    m_renderers[i] = nullptr;
+    plutovg_surface_destroy(m_surfaces[i]);
+    m_surfaces[i] = nullptr;
+  }
+  return !m_failed;
+}
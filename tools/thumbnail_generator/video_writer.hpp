@@ -0,0 +1,94 @@
+// Copyright (c) 2021-present Sparky Studios. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#ifndef _THUMBNAIL_GENERATOR_VIDEO_WRITER_HPP_
+#define _THUMBNAIL_GENERATOR_VIDEO_WRITER_HPP_
+
+#include <plutonriver/renderer.hpp>
+#include <plutonriver/yuv_converter.hpp>
+
+#include <plutovg.h>
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class VideoFormat
+{
+  // YUV4MPEG2 stream of I420 frames, readable by ffmpeg -f yuv4mpegpipe.
+  y4m,
+  // Headerless frames, readable by ffmpeg -f rawvideo -pix_fmt yuv420p|nv12.
+  i420,
+  nv12,
+};
+
+// Streams frames as YUV to a file, a fifo or stdout ("-"). Frames are rendered
+// into one of two surfaces while the other one is converted and written on a
+// writer thread.
+class VideoWriter
+{
+public:
+  VideoWriter() = default;
+  VideoWriter(const VideoWriter&) = delete;
+  VideoWriter& operator=(const VideoWriter&) = delete;
+  ~VideoWriter();
+
+  bool open(const std::string& path, VideoFormat format, int width, int height, float fps);
+
+  // Returns the renderer of the next frame, its surface cleared, waiting for
+  // the writer to be done converting it. Returns nullptr once a write failed,
+  // the remaining frames need not be rendered.
+  rive::PlutoVG_Renderer* acquireFrame();
+  // Queues the frame returned by acquireFrame().
+  void submitFrame();
+  // Queues the previous frame once more. Returns false once a write failed.
+  bool repeatFrame();
+
+  // Writes the queued frames and closes the output. Returns false if any write
+  // failed.
+  bool close();
+
+private:
+  void run();
+
+  VideoFormat m_format{VideoFormat::y4m};
+  int m_width{0};
+  int m_height{0};
+  FILE* m_output{nullptr};
+  std::vector<uint8_t> m_frame;
+
+  plutovg_surface_t* m_surfaces[2]{nullptr, nullptr};
+  // Kept across frames so that only the area drawn by the previous frame of a
+  // surface is cleared.
+  std::unique_ptr<rive::PlutoVG_Renderer> m_renderers[2];
+  bool m_busy[2]{false, false};
+  int m_next{0};
+
+  // Indices of the surfaces to write, -1 repeats the previous frame.
+  std::deque<int> m_queue;
+  bool m_closing{false};
+  bool m_failed{false};
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::thread m_thread;
+};
+
+#endif